@@ -45,8 +45,11 @@
 //#include "config.h"
 
 /* Include the best multiplexing layer supported by this system.
- * The following should be ordered by performances, descending. */
-#ifdef HAVE_EVPORT
+ * The following should be ordered by performances, descending.
+ * io_uring is selected at run time, it includes epoll as the fallback. */
+#ifdef HAVE_IOURING
+#include "ae_iouring.c"
+#elif defined(HAVE_EVPORT)
 #include "ae_evport.c"
 #else
     #ifdef HAVE_EPOLL
@@ -75,6 +78,8 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
+    eventLoop->flags = 0;
+    eventLoop->apiuring = 0;
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
@@ -400,6 +405,12 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
         }
 
+        /* There is work left for the next iteration, don't sleep */
+        if (eventLoop->flags & AE_DONT_WAIT) {
+            tv.tv_sec = tv.tv_usec = 0;
+            tvp = &tv;
+        }
+
         numevents = aeApiPoll(eventLoop, tvp);
         for (j = 0; j < numevents; j++) {
             aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
@@ -463,6 +474,26 @@ char *aeGetApiName(void) {
     return aeApiName();
 }
 
+/* Make the event loops created afterwards use io_uring. A loop falls back
+ * to the default backend when the kernel refuses the ring, check apiuring.
+ * Return AE_ERR when io_uring support is not compiled in. */
+int aeSetIouring(int enable) {
+#ifdef HAVE_IOURING
+    aeUringEnabled = enable;
+    return AE_OK;
+#else
+    return enable ? AE_ERR : AE_OK;
+#endif
+}
+
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+/* Have the loop poll without sleeping while noWait is set. */
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait) {
+    if (noWait)
+        eventLoop->flags |= AE_DONT_WAIT;
+    else
+        eventLoop->flags &= ~AE_DONT_WAIT;
+}
@@ -97,7 +97,9 @@ typedef struct aeEventLoop {
     aeTimeEvent *timeEventHead;
     int stop;
     void *apidata; /* This is used for polling API specific data */
+    int apiuring;  /* apidata is an io_uring, see aeSetIouring() */
     aeBeforeSleepProc *beforesleep;
+    int flags;     /* AE_DONT_WAIT: poll without sleeping, see aeSetDontWait() */
 } aeEventLoop;
 
 /* Prototypes */
@@ -116,7 +118,9 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
+int aeSetIouring(int enable);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+void aeSetDontWait(aeEventLoop *eventLoop, int noWait);
 int aeGetSetSize(aeEventLoop *eventLoop);
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
 
@@ -0,0 +1,355 @@
+/* Linux io_uring(7) based ae.c module
+ *
+ * Readiness is watched with one shot IORING_OP_POLL_ADD requests. A fired
+ * poll is armed again right before the next wait, after the handlers ran,
+ * so the events stay level triggered like with epoll. The poll requests
+ * queued by a loop iteration are submitted by the same io_uring_enter(2)
+ * that waits for completions, so registering, modifying and waiting cost
+ * a single system call per iteration, none at all when completions are
+ * already in the ring.
+ *
+ * The backend is chosen at run time with aeSetIouring(). When the kernel
+ * refuses the ring (old kernel, seccomp, io_uring_disabled) a loop quietly
+ * uses epoll instead and reports it through eventLoop->apiuring.
+ *
+ * The kernel interface is used directly, liburing is not needed. */
+
+#include "ae.h"
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* the epoll module serves loops that can not get a ring */
+#include "ae_epoll.c"
+
+#define AE_URING_SQ_ENTRIES 1024
+#define AE_URING_CQ_MAX 65536
+#define AE_URING_NOFD UINT64_MAX  /* user_data of poll removals */
+
+/* user_data of a poll: the fd and the generation of the fd when armed. A
+ * removal bumps the generation so the completion of the removed poll, and
+ * anything it raced with, is recognized as stale. */
+#define AE_URING_DATA(fd,gen) (((uint64_t)(gen) << 32) | (uint32_t)(fd))
+#define AE_URING_FD(data) ((int)(uint32_t)(data))
+#define AE_URING_GEN(data) ((uint32_t)((data) >> 32))
+
+typedef struct aeUringFd {
+    uint32_t gen;
+    int armed;      /* mask of the poll in flight, AE_NONE if none */
+    int rearm;      /* queued in rearm[] */
+} aeUringFd;
+
+typedef struct aeUringState {
+    int ringfd;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    unsigned sq_entries;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+    aeUringFd *fds;
+    int *rearm;             /* fds whose poll fired, armed again before waiting */
+    int nrearm;
+} aeUringState;
+
+static int aeUringEnabled = 0;
+
+static int aeUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+        unsigned flags, void *arg, size_t argsz)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+            flags, arg, argsz);
+}
+
+static void aeUringRelease(aeUringState *state) {
+    if (state->sqes) munmap(state->sqes, state->sqes_sz);
+    if (state->cq_ring && state->cq_ring != state->sq_ring)
+        munmap(state->cq_ring, state->cq_ring_sz);
+    if (state->sq_ring) munmap(state->sq_ring, state->sq_ring_sz);
+    if (state->ringfd != -1) close(state->ringfd);
+    free(state->fds);
+    free(state->rearm);
+    free(state);
+}
+
+static int aeUringCreate(aeEventLoop *eventLoop) {
+    aeUringState *state = calloc(1, sizeof(aeUringState));
+    struct io_uring_params p;
+    unsigned cq = 4096;
+
+    if (!state) return -1;
+    state->ringfd = -1;
+    state->fds = calloc(eventLoop->setsize, sizeof(aeUringFd));
+    state->rearm = malloc(sizeof(int)*eventLoop->setsize);
+    if (!state->fds || !state->rearm) goto err;
+
+    /* every fd may have a poll completion pending */
+    while (cq < (unsigned)eventLoop->setsize*2 && cq < AE_URING_CQ_MAX) cq <<= 1;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq;
+    if ((state->ringfd = aeUringSetup(AE_URING_SQ_ENTRIES, &p)) == -1) goto err;
+    /* waiting with a timeout needs IORING_ENTER_EXT_ARG */
+    if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP))
+        goto err;
+
+    state->sq_ring_sz = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    state->cq_ring_sz = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (state->cq_ring_sz > state->sq_ring_sz)
+            state->sq_ring_sz = state->cq_ring_sz;
+        state->cq_ring_sz = state->sq_ring_sz;
+    }
+    state->sq_ring = mmap(NULL, state->sq_ring_sz, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQ_RING);
+    if (state->sq_ring == MAP_FAILED) { state->sq_ring = NULL; goto err; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        state->cq_ring = state->sq_ring;
+    } else {
+        state->cq_ring = mmap(NULL, state->cq_ring_sz, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_CQ_RING);
+        if (state->cq_ring == MAP_FAILED) { state->cq_ring = NULL; goto err; }
+    }
+    state->sqes_sz = p.sq_entries*sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_sz, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) { state->sqes = NULL; goto err; }
+
+    state->sq_head = (unsigned *)((char *)state->sq_ring + p.sq_off.head);
+    state->sq_tail = (unsigned *)((char *)state->sq_ring + p.sq_off.tail);
+    state->sq_mask = (unsigned *)((char *)state->sq_ring + p.sq_off.ring_mask);
+    state->sq_array = (unsigned *)((char *)state->sq_ring + p.sq_off.array);
+    state->cq_head = (unsigned *)((char *)state->cq_ring + p.cq_off.head);
+    state->cq_tail = (unsigned *)((char *)state->cq_ring + p.cq_off.tail);
+    state->cq_mask = (unsigned *)((char *)state->cq_ring + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe *)((char *)state->cq_ring + p.cq_off.cqes);
+    state->sq_entries = p.sq_entries;
+    eventLoop->apidata = state;
+    return 0;
+
+err:
+    aeUringRelease(state);
+    return -1;
+}
+
+static int aeUringResize(aeEventLoop *eventLoop, int setsize) {
+    aeUringState *state = eventLoop->apidata;
+    aeUringFd *fds = realloc(state->fds, sizeof(aeUringFd)*setsize);
+    int *rearm;
+
+    if (!fds) return -1;
+    state->fds = fds;
+    if (setsize > eventLoop->setsize)
+        memset(fds+eventLoop->setsize, 0,
+                sizeof(aeUringFd)*(setsize-eventLoop->setsize));
+    /* shrinking is refused by ae.c while an fd beyond setsize is in use,
+     * so the queued fds all fit */
+    if (!(rearm = realloc(state->rearm, sizeof(int)*setsize))) return -1;
+    state->rearm = rearm;
+    return 0;
+}
+
+/* Number of queued sqes the kernel did not consume yet. */
+static unsigned aeUringPending(aeUringState *state) {
+    return *state->sq_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Return a free sqe, submitting the queued ones when the ring is full. */
+static struct io_uring_sqe *aeUringGetSqe(aeUringState *state) {
+    unsigned tail = *state->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+
+    if (aeUringPending(state) == state->sq_entries &&
+        aeUringEnter(state->ringfd, state->sq_entries, 0, 0, NULL, 0) <= 0)
+        return NULL;
+    idx = tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    __atomic_store_n(state->sq_tail, tail+1, __ATOMIC_RELEASE);
+    return sqe;
+}
+
+static int aeUringArm(aeUringState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    if (mask & AE_READABLE) sqe->poll32_events |= POLLIN;
+    if (mask & AE_WRITABLE) sqe->poll32_events |= POLLOUT;
+    sqe->user_data = AE_URING_DATA(fd, state->fds[fd].gen);
+    state->fds[fd].armed = mask;
+    return 0;
+}
+
+static int aeUringDisarm(aeUringState *state, int fd) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+    if (!sqe) return -1;
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = AE_URING_DATA(fd, state->fds[fd].gen);
+    sqe->user_data = AE_URING_NOFD;
+    state->fds[fd].gen++;
+    state->fds[fd].armed = AE_NONE;
+    return 0;
+}
+
+/* Make the poll in flight for fd watch mask. */
+static int aeUringWatch(aeUringState *state, int fd, int mask) {
+    if (state->fds[fd].armed == mask) return 0;
+    if (state->fds[fd].armed != AE_NONE && aeUringDisarm(state, fd) == -1)
+        return -1;
+    if (mask != AE_NONE) return aeUringArm(state, fd, mask);
+    return 0;
+}
+
+/* The polls in flight hold their files, a socket closed by the caller
+ * lives on until the ring is torn down, and that happens asynchronously.
+ * Remove them now so the files are released with their last close. */
+static void aeUringFree(aeEventLoop *eventLoop) {
+    aeUringState *state = eventLoop->apidata;
+    int fd;
+
+    for (fd = 0; fd <= eventLoop->maxfd; fd++) {
+        if (state->fds[fd].armed != AE_NONE) aeUringDisarm(state, fd);
+    }
+    if (aeUringPending(state))
+        aeUringEnter(state->ringfd, aeUringPending(state), 0, 0, NULL, 0);
+    aeUringRelease(state);
+}
+
+static int aeUringAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    return aeUringWatch(eventLoop->apidata, fd, mask|eventLoop->events[fd].mask);
+}
+
+static void aeUringDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeUringWatch(eventLoop->apidata, fd, eventLoop->events[fd].mask & (~delmask));
+}
+
+static int aeUringPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeUringState *state = eventLoop->apidata;
+    int nowait = tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0;
+    unsigned head, tail, pending;
+    int j, numevents = 0;
+
+    /* arm again the polls that fired in the previous iteration */
+    for (j = 0; j < state->nrearm; j++) {
+        int fd = state->rearm[j];
+
+        state->fds[fd].rearm = 0;
+        if (state->fds[fd].armed == AE_NONE &&
+            eventLoop->events[fd].mask != AE_NONE)
+            aeUringArm(state, fd, eventLoop->events[fd].mask);
+    }
+    state->nrearm = 0;
+
+    /* submit and wait in one call, skip it when completions are ready */
+    head = *state->cq_head;
+    tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    pending = aeUringPending(state);
+    if (pending || (head == tail && !nowait)) {
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        unsigned wait = head == tail && !nowait;
+
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG/8;
+        if (tvp) {
+            ts.tv_sec = tvp->tv_sec;
+            ts.tv_nsec = tvp->tv_usec*1000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+        /* errors are ETIME for the timeout, EINTR for a signal and EBUSY
+         * when only reaping the completion queue makes room, the sqes the
+         * kernel did not consume are submitted by the next call */
+        aeUringEnter(state->ringfd, pending, wait,
+                (wait ? IORING_ENTER_GETEVENTS : 0)|IORING_ENTER_EXT_ARG,
+                &arg, sizeof(arg));
+        tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    while (head != tail && numevents < eventLoop->setsize) {
+        struct io_uring_cqe *cqe = &state->cqes[head & *state->cq_mask];
+        uint64_t data = cqe->user_data;
+        int fd = AE_URING_FD(data), mask = 0;
+
+        head++;
+        if (data == AE_URING_NOFD || fd >= eventLoop->setsize ||
+            AE_URING_GEN(data) != state->fds[fd].gen)
+            continue;
+        /* a one shot poll completes once, whatever the result */
+        if (!state->fds[fd].rearm) {
+            state->fds[fd].rearm = 1;
+            state->rearm[state->nrearm++] = fd;
+        }
+        if (cqe->res < 0) {
+            /* let the handlers meet the error in their own calls */
+            mask = state->fds[fd].armed;
+        } else {
+            if (cqe->res & POLLIN) mask |= AE_READABLE;
+            if (cqe->res & POLLOUT) mask |= AE_WRITABLE;
+            if (cqe->res & POLLERR) mask |= AE_WRITABLE;
+            if (cqe->res & POLLHUP) mask |= AE_WRITABLE;
+        }
+        state->fds[fd].armed = AE_NONE;
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = mask;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+    return numevents;
+}
+
+/* Dispatch to io_uring or to epoll depending on what the loop got. */
+static int aeApiDispatchCreate(aeEventLoop *eventLoop) {
+    if (aeUringEnabled && aeUringCreate(eventLoop) == 0) {
+        eventLoop->apiuring = 1;
+        return 0;
+    }
+    return aeApiCreate(eventLoop);
+}
+
+static int aeApiDispatchResize(aeEventLoop *eventLoop, int setsize) {
+    return eventLoop->apiuring ? aeUringResize(eventLoop, setsize) :
+            aeApiResize(eventLoop, setsize);
+}
+
+static void aeApiDispatchFree(aeEventLoop *eventLoop) {
+    if (eventLoop->apiuring) aeUringFree(eventLoop);
+    else aeApiFree(eventLoop);
+}
+
+static int aeApiDispatchAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    return eventLoop->apiuring ? aeUringAddEvent(eventLoop, fd, mask) :
+            aeApiAddEvent(eventLoop, fd, mask);
+}
+
+static void aeApiDispatchDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    if (eventLoop->apiuring) aeUringDelEvent(eventLoop, fd, delmask);
+    else aeApiDelEvent(eventLoop, fd, delmask);
+}
+
+static int aeApiDispatchPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    return eventLoop->apiuring ? aeUringPoll(eventLoop, tvp) :
+            aeApiPoll(eventLoop, tvp);
+}
+
+/* from here on ae.c calls the dispatchers */
+#define aeApiCreate aeApiDispatchCreate
+#define aeApiResize aeApiDispatchResize
+#define aeApiFree aeApiDispatchFree
+#define aeApiAddEvent aeApiDispatchAddEvent
+#define aeApiDelEvent aeApiDispatchDelEvent
+#define aeApiPoll aeApiDispatchPoll
@@ -88,6 +88,27 @@ int anetBlock(char *err, int fd) {
     return anetSetBlock(err,fd,0);
 }
 
+/* Set the FD_CLOEXEC flag of fd so it does not leak into children. */
+int anetCloexec(int fd) {
+    int r;
+    int flags;
+
+    do {
+        r = fcntl(fd, F_GETFD);
+    } while (r == -1 && errno == EINTR);
+
+    if (r == -1 || (r & FD_CLOEXEC))
+        return r;
+
+    flags = r | FD_CLOEXEC;
+
+    do {
+        r = fcntl(fd, F_SETFD, flags);
+    } while (r == -1 && errno == EINTR);
+
+    return r;
+}
+
 /* Set TCP keep alive option to detect dead peers. The interval option
  * is only used for Linux as we are using Linux-specific APIs to set
  * the probe send time, interval, and count. */
@@ -245,6 +266,23 @@ static int anetSetReuseAddr(char *err, int fd) {
     return ANET_OK;
 }
 
+/* Let several sockets listen on the same port, the kernel spreads the
+ * incoming connections among them. */
+static int anetSetReusePort(char *err, int fd) {
+#ifdef SO_REUSEPORT
+    int yes = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    (void)fd;
+    anetSetError(err, "SO_REUSEPORT is not supported");
+    return ANET_ERR;
+#endif
+}
+
 static int anetCreateSocket(char *err, int domain) {
     int s;
     if ((s = socket(domain, SOCK_STREAM, 0)) == -1) {
@@ -459,7 +497,7 @@ static int anetV6Only(char *err, int s) {
     return ANET_OK;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog)
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog, int flags)
 {
     int s, rv;
     char _port[6];  /* strlen("65535") */
@@ -481,6 +519,7 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
 
         if (af == AF_INET6 && anetV6Only(err,s) == ANET_ERR) goto error;
         if (anetSetReuseAddr(err,s) == ANET_ERR) goto error;
+        if ((flags & ANET_REUSEPORT) && anetSetReusePort(err,s) == ANET_ERR) goto error;
         if (anetListen(err,s,p->ai_addr,p->ai_addrlen,backlog) == ANET_ERR) goto error;
         goto end;
     }
@@ -498,12 +537,18 @@ end:
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_NONE);
+}
+
+/* Like anetTcpServer(), flags may ask for ANET_REUSEPORT. */
+int anetTcpServerFlags(char *err, int port, char *bindaddr, int backlog, int flags)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, flags);
 }
 
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_NONE);
 }
 
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
@@ -527,7 +572,11 @@ int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
 static int anetGenericAccept(char *err, int s, struct sockaddr *sa, socklen_t *len) {
     int fd;
     while(1) {
+#ifdef HAVE_ACCEPT4
+        fd = accept4(s,sa,len,SOCK_NONBLOCK|SOCK_CLOEXEC);
+#else
         fd = accept(s,sa,len);
+#endif
         if (fd == -1) {
             if (errno == EINTR)
                 continue;
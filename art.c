@@ -0,0 +1,945 @@
+#include "art.h"
+#include "zmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define ART_LEAF_HDR sizeof(art_leaf)
+
+#define ART_IS_LEAF(p) ((uintptr_t)(p) & 1)
+#define ART_LEAF(p) ((art_leaf *)((uintptr_t)(p) & ~(uintptr_t)1))
+#define ART_TAG(l) ((art_node *)((uintptr_t)(l) | 1))
+
+#define ART_MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static art_leaf *art_leaf_create(art_tree *t, sds key, const char *val, size_t vlen)
+{
+	size_t klen = sdslen(key);
+	size_t prefix = index_entry_prefix(ART_LEAF_HDR, klen);
+	size_t vcap;
+	art_leaf *l;
+
+	if (t->arena) {
+		size_t slot = t->arena->classes[0].size;
+		if (prefix + vlen > slot) {
+			return NULL;
+		}
+		l = (art_leaf *)slab_alloc(t->arena, 0);
+		if (!l) {
+			return NULL;
+		}
+		vcap = slot - prefix;
+	} else {
+		l = (art_leaf *)malloc(prefix + vlen);
+		if (!l) {
+			return NULL;
+		}
+		vcap = malloc_usable_size(l) - prefix;
+	}
+
+	index_entry_init(&l->entry, ART_LEAF_HDR, key, klen, val, vlen, vcap);
+	l->prev = l->next = NULL;
+	return l;
+}
+
+static void art_leaf_free(art_tree *t, art_leaf *l)
+{
+	if (t->arena) {
+		slab_free(t->arena, 0, l);
+	} else {
+		index_entry_free_val(&l->entry);
+		free(l);
+	}
+}
+
+static int art_leaf_matches(art_leaf *l, sds key)
+{
+	sds lkey = ENTRY_KEY(&l->entry);
+
+	return sdslen(lkey) == sdslen(key) && !memcmp(lkey, key, sdslen(key));
+}
+
+static art_node *art_node_create(art_tree *t, uint8_t type)
+{
+	size_t size;
+	art_node *n;
+
+	switch (type) {
+	case ART_NODE4: size = sizeof(art_node4); break;
+	case ART_NODE16: size = sizeof(art_node16); break;
+	case ART_NODE48: size = sizeof(art_node48); break;
+	default: size = sizeof(art_node256); break;
+	}
+	n = zcalloc(size);
+	n->type = type;
+	t->nodes++;
+	return n;
+}
+
+static void art_node_free(art_tree *t, art_node *n)
+{
+	zfree(n);
+	t->nodes--;
+}
+
+/* Copy the header of a node being replaced by a larger or smaller one. */
+static void art_copy_header(art_node *dst, art_node *src)
+{
+	dst->nchildren = src->nchildren;
+	dst->plen = src->plen;
+	memcpy(dst->prefix, src->prefix, ART_MIN(src->plen, ART_MAX_PREFIX));
+	dst->leaf = src->leaf;
+}
+
+/* Slot of the child for byte c, NULL if there is none. */
+static art_node **art_find_child(art_node *n, unsigned char c)
+{
+	int i;
+
+	switch (n->type) {
+	case ART_NODE4: {
+		art_node4 *p = (art_node4 *)n;
+		for (i = 0; i < n->nchildren; i++) {
+			if (p->keys[i] == c) {
+				return &p->children[i];
+			}
+		}
+		break;
+	}
+	case ART_NODE16: {
+		art_node16 *p = (art_node16 *)n;
+#ifdef __SSE2__
+		__m128i cmp = _mm_cmpeq_epi8(_mm_set1_epi8(c),
+				_mm_loadu_si128((__m128i *)p->keys));
+		int bits = _mm_movemask_epi8(cmp) & ((1 << n->nchildren) - 1);
+		if (bits) {
+			return &p->children[__builtin_ctz(bits)];
+		}
+#else
+		for (i = 0; i < n->nchildren; i++) {
+			if (p->keys[i] == c) {
+				return &p->children[i];
+			}
+		}
+#endif
+		break;
+	}
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)n;
+		if (p->index[c]) {
+			return &p->children[p->index[c] - 1];
+		}
+		break;
+	}
+	case ART_NODE256: {
+		art_node256 *p = (art_node256 *)n;
+		if (p->children[c]) {
+			return &p->children[c];
+		}
+		break;
+	}
+	}
+	return NULL;
+}
+
+/* Child with the smallest byte greater than c, NULL if there is none. */
+static art_node *art_next_child(art_node *n, unsigned char c)
+{
+	int i;
+
+	switch (n->type) {
+	case ART_NODE4:
+	case ART_NODE16: {
+		unsigned char *keys = n->type == ART_NODE4 ?
+			((art_node4 *)n)->keys : ((art_node16 *)n)->keys;
+		art_node **children = n->type == ART_NODE4 ?
+			((art_node4 *)n)->children : ((art_node16 *)n)->children;
+		for (i = 0; i < n->nchildren; i++) {
+			if (keys[i] > c) {
+				return children[i];
+			}
+		}
+		break;
+	}
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)n;
+		for (i = c + 1; i < 256; i++) {
+			if (p->index[i]) {
+				return p->children[p->index[i] - 1];
+			}
+		}
+		break;
+	}
+	case ART_NODE256: {
+		art_node256 *p = (art_node256 *)n;
+		for (i = c + 1; i < 256; i++) {
+			if (p->children[i]) {
+				return p->children[i];
+			}
+		}
+		break;
+	}
+	}
+	return NULL;
+}
+
+/* Smallest leaf under n, n may itself be a tagged leaf. A key ending at a
+ * node sorts before every key below it. */
+static art_leaf *art_minimum(art_node *n)
+{
+	while (n && !ART_IS_LEAF(n)) {
+		if (n->leaf) {
+			return ART_LEAF(n->leaf);
+		}
+		switch (n->type) {
+		case ART_NODE4: n = ((art_node4 *)n)->children[0]; break;
+		case ART_NODE16: n = ((art_node16 *)n)->children[0]; break;
+		default: {
+			art_node **first = art_find_child(n, 0);
+			n = first ? *first : art_next_child(n, 0);
+			break;
+		}
+		}
+	}
+	return n ? ART_LEAF(n) : NULL;
+}
+
+static void art_add_child(art_tree *t, art_node *n, art_node **ref, unsigned char c, art_node *child);
+
+static void art_add_child256(art_node256 *p, unsigned char c, art_node *child)
+{
+	p->n.nchildren++;
+	p->children[c] = child;
+}
+
+static void art_add_child48(art_tree *t, art_node48 *p, art_node **ref, unsigned char c, art_node *child)
+{
+	int i;
+
+	if (p->n.nchildren < 48) {
+		/* slots are not kept packed after removals */
+		for (i = 0; p->children[i]; i++);
+		p->children[i] = child;
+		p->index[c] = i + 1;
+		p->n.nchildren++;
+		return;
+	}
+
+	art_node256 *big = (art_node256 *)art_node_create(t, ART_NODE256);
+	for (i = 0; i < 256; i++) {
+		if (p->index[i]) {
+			big->children[i] = p->children[p->index[i] - 1];
+		}
+	}
+	art_copy_header(&big->n, &p->n);
+	*ref = &big->n;
+	art_node_free(t, &p->n);
+	art_add_child256(big, c, child);
+}
+
+static void art_add_child16(art_tree *t, art_node16 *p, art_node **ref, unsigned char c, art_node *child)
+{
+	int i, n = p->n.nchildren;
+
+	if (n < 16) {
+		for (i = 0; i < n && p->keys[i] < c; i++);
+		memmove(p->keys + i + 1, p->keys + i, n - i);
+		memmove(p->children + i + 1, p->children + i, (n - i) * sizeof(art_node *));
+		p->keys[i] = c;
+		p->children[i] = child;
+		p->n.nchildren++;
+		return;
+	}
+
+	art_node48 *big = (art_node48 *)art_node_create(t, ART_NODE48);
+	memcpy(big->children, p->children, n * sizeof(art_node *));
+	for (i = 0; i < n; i++) {
+		big->index[p->keys[i]] = i + 1;
+	}
+	art_copy_header(&big->n, &p->n);
+	*ref = &big->n;
+	art_node_free(t, &p->n);
+	art_add_child48(t, big, ref, c, child);
+}
+
+static void art_add_child4(art_tree *t, art_node4 *p, art_node **ref, unsigned char c, art_node *child)
+{
+	int i, n = p->n.nchildren;
+
+	if (n < 4) {
+		for (i = 0; i < n && p->keys[i] < c; i++);
+		memmove(p->keys + i + 1, p->keys + i, n - i);
+		memmove(p->children + i + 1, p->children + i, (n - i) * sizeof(art_node *));
+		p->keys[i] = c;
+		p->children[i] = child;
+		p->n.nchildren++;
+		return;
+	}
+
+	art_node16 *big = (art_node16 *)art_node_create(t, ART_NODE16);
+	memcpy(big->keys, p->keys, n);
+	memcpy(big->children, p->children, n * sizeof(art_node *));
+	art_copy_header(&big->n, &p->n);
+	*ref = &big->n;
+	art_node_free(t, &p->n);
+	art_add_child16(t, big, ref, c, child);
+}
+
+/* Add child under byte c, growing n when it is full. ref points to n and
+ * is updated when n is replaced. */
+static void art_add_child(art_tree *t, art_node *n, art_node **ref, unsigned char c, art_node *child)
+{
+	switch (n->type) {
+	case ART_NODE4: art_add_child4(t, (art_node4 *)n, ref, c, child); break;
+	case ART_NODE16: art_add_child16(t, (art_node16 *)n, ref, c, child); break;
+	case ART_NODE48: art_add_child48(t, (art_node48 *)n, ref, c, child); break;
+	case ART_NODE256: art_add_child256((art_node256 *)n, c, child); break;
+	}
+}
+
+/* Number of prefix bytes of n matching key from depth, only the stored
+ * ones are compared. Lookups check the whole key on the leaf anyway. */
+static size_t art_check_prefix(art_node *n, sds key, size_t depth)
+{
+	size_t max = ART_MIN(ART_MIN(n->plen, ART_MAX_PREFIX), sdslen(key) - depth);
+	size_t i;
+
+	for (i = 0; i < max; i++) {
+		if (n->prefix[i] != (unsigned char)key[depth + i]) {
+			break;
+		}
+	}
+	return i;
+}
+
+/* Number of prefix bytes of n matching key from depth. Bytes beyond the
+ * stored ones are read from the smallest leaf below n. */
+static size_t art_prefix_mismatch(art_node *n, sds key, size_t depth)
+{
+	size_t klen = sdslen(key);
+	size_t max = ART_MIN(ART_MIN(n->plen, ART_MAX_PREFIX), klen - depth);
+	size_t i;
+
+	for (i = 0; i < max; i++) {
+		if (n->prefix[i] != (unsigned char)key[depth + i]) {
+			return i;
+		}
+	}
+
+	if (n->plen > ART_MAX_PREFIX) {
+		sds lkey = ENTRY_KEY(&art_minimum(n)->entry);
+		max = ART_MIN(n->plen, ART_MIN(sdslen(lkey), klen) - depth);
+		for (; i < max; i++) {
+			if (lkey[depth + i] != key[depth + i]) {
+				return i;
+			}
+		}
+	}
+	return i;
+}
+
+/* Link a new leaf into the tree, its key must not be there yet. */
+static void art_insert_leaf(art_tree *t, art_leaf *l)
+{
+	sds key = ENTRY_KEY(&l->entry);
+	size_t klen = sdslen(key), depth = 0, i;
+	art_node **ref = &t->root;
+
+	for (;;) {
+		art_node *n = *ref, *nn;
+
+		if (!n) {
+			*ref = ART_TAG(l);
+			return;
+		}
+
+		if (ART_IS_LEAF(n)) {
+			/* two keys share this slot, branch where they diverge */
+			art_leaf *old = ART_LEAF(n);
+			sds okey = ENTRY_KEY(&old->entry);
+			size_t max = ART_MIN(sdslen(okey), klen);
+
+			for (i = depth; i < max && okey[i] == key[i]; i++);
+			nn = art_node_create(t, ART_NODE4);
+			nn->plen = i - depth;
+			memcpy(nn->prefix, key + depth, ART_MIN(nn->plen, ART_MAX_PREFIX));
+			if (sdslen(okey) == i) {
+				nn->leaf = n;
+			} else {
+				art_add_child(t, nn, &nn, okey[i], n);
+			}
+			if (klen == i) {
+				nn->leaf = ART_TAG(l);
+			} else {
+				art_add_child(t, nn, &nn, key[i], ART_TAG(l));
+			}
+			*ref = nn;
+			return;
+		}
+
+		if (n->plen) {
+			size_t diff = art_prefix_mismatch(n, key, depth);
+
+			if (diff < n->plen) {
+				/* split the prefix, n goes below a new node */
+				nn = art_node_create(t, ART_NODE4);
+				nn->plen = diff;
+				memcpy(nn->prefix, n->prefix, ART_MIN(diff, ART_MAX_PREFIX));
+				if (n->plen <= ART_MAX_PREFIX) {
+					art_add_child(t, nn, &nn, n->prefix[diff], n);
+					n->plen -= diff + 1;
+					memmove(n->prefix, n->prefix + diff + 1, ART_MIN(n->plen, ART_MAX_PREFIX));
+				} else {
+					sds lkey = ENTRY_KEY(&art_minimum(n)->entry);
+					art_add_child(t, nn, &nn, lkey[depth + diff], n);
+					n->plen -= diff + 1;
+					memcpy(n->prefix, lkey + depth + diff + 1, ART_MIN(n->plen, ART_MAX_PREFIX));
+				}
+				if (klen == depth + diff) {
+					nn->leaf = ART_TAG(l);
+				} else {
+					art_add_child(t, nn, &nn, key[depth + diff], ART_TAG(l));
+				}
+				*ref = nn;
+				return;
+			}
+			depth += n->plen;
+		}
+
+		if (depth == klen) {
+			n->leaf = ART_TAG(l);
+			return;
+		}
+
+		art_node **child = art_find_child(n, key[depth]);
+		if (!child) {
+			art_add_child(t, n, ref, key[depth], ART_TAG(l));
+			return;
+		}
+		ref = child;
+		depth++;
+	}
+}
+
+/* Slot holding the tagged leaf of key, NULL if key is not there. */
+static art_node **art_find_slot(art_tree *t, sds key)
+{
+	size_t klen = sdslen(key), depth = 0;
+	art_node **ref = &t->root;
+
+	while (*ref) {
+		art_node *n = *ref;
+
+		if (ART_IS_LEAF(n)) {
+			return art_leaf_matches(ART_LEAF(n), key) ? ref : NULL;
+		}
+		if (n->plen) {
+			if (art_check_prefix(n, key, depth) != ART_MIN(n->plen, ART_MAX_PREFIX)) {
+				return NULL;
+			}
+			depth += n->plen;
+			if (depth > klen) {
+				return NULL;
+			}
+		}
+		if (depth == klen) {
+			if (n->leaf && art_leaf_matches(ART_LEAF(n->leaf), key)) {
+				return &n->leaf;
+			}
+			return NULL;
+		}
+		ref = art_find_child(n, key[depth]);
+		if (!ref) {
+			return NULL;
+		}
+		depth++;
+	}
+	return NULL;
+}
+
+/* Replace a node4 left with a single item by that item. */
+static void art_compact4(art_tree *t, art_node4 *p, art_node **ref)
+{
+	art_node *child;
+	size_t len;
+
+	if (p->n.nchildren == 0) {
+		*ref = p->n.leaf;
+		art_node_free(t, &p->n);
+		return;
+	}
+	if (p->n.nchildren > 1 || p->n.leaf) {
+		return;
+	}
+
+	child = p->children[0];
+	if (!ART_IS_LEAF(child)) {
+		/* the child prefix becomes our prefix, the byte and its own */
+		len = p->n.plen;
+		if (len < ART_MAX_PREFIX) {
+			p->n.prefix[len++] = p->keys[0];
+		}
+		if (len < ART_MAX_PREFIX) {
+			size_t sub = ART_MIN(child->plen, ART_MAX_PREFIX - len);
+			memcpy(p->n.prefix + len, child->prefix, sub);
+			len += sub;
+		}
+		memcpy(child->prefix, p->n.prefix, ART_MIN(len, ART_MAX_PREFIX));
+		child->plen += p->n.plen + 1;
+	}
+	*ref = child;
+	art_node_free(t, &p->n);
+}
+
+/* Drop the child at slot of n, shrinking n when it gets sparse. */
+static void art_remove_child(art_tree *t, art_node *n, art_node **ref, unsigned char c, art_node **slot)
+{
+	int i, pos;
+
+	switch (n->type) {
+	case ART_NODE4:
+	case ART_NODE16: {
+		unsigned char *keys = n->type == ART_NODE4 ?
+			((art_node4 *)n)->keys : ((art_node16 *)n)->keys;
+		art_node **children = n->type == ART_NODE4 ?
+			((art_node4 *)n)->children : ((art_node16 *)n)->children;
+		pos = slot - children;
+		memmove(keys + pos, keys + pos + 1, n->nchildren - 1 - pos);
+		memmove(children + pos, children + pos + 1, (n->nchildren - 1 - pos) * sizeof(art_node *));
+		n->nchildren--;
+		if (n->type == ART_NODE4) {
+			art_compact4(t, (art_node4 *)n, ref);
+		} else if (n->nchildren == 3) {
+			art_node4 *small = (art_node4 *)art_node_create(t, ART_NODE4);
+			art_copy_header(&small->n, n);
+			memcpy(small->keys, keys, 3);
+			memcpy(small->children, children, 3 * sizeof(art_node *));
+			*ref = &small->n;
+			art_node_free(t, n);
+		}
+		break;
+	}
+	case ART_NODE48: {
+		art_node48 *p = (art_node48 *)n;
+		p->children[p->index[c] - 1] = NULL;
+		p->index[c] = 0;
+		n->nchildren--;
+		if (n->nchildren == 12) {
+			art_node16 *small = (art_node16 *)art_node_create(t, ART_NODE16);
+			art_copy_header(&small->n, n);
+			for (i = 0, pos = 0; i < 256; i++) {
+				if (p->index[i]) {
+					small->keys[pos] = i;
+					small->children[pos++] = p->children[p->index[i] - 1];
+				}
+			}
+			*ref = &small->n;
+			art_node_free(t, n);
+		}
+		break;
+	}
+	case ART_NODE256: {
+		art_node256 *p = (art_node256 *)n;
+		p->children[c] = NULL;
+		n->nchildren--;
+		if (n->nchildren == 37) {
+			art_node48 *small = (art_node48 *)art_node_create(t, ART_NODE48);
+			art_copy_header(&small->n, n);
+			for (i = 0, pos = 0; i < 256; i++) {
+				if (p->children[i]) {
+					small->children[pos] = p->children[i];
+					small->index[i] = ++pos;
+				}
+			}
+			*ref = &small->n;
+			art_node_free(t, n);
+		}
+		break;
+	}
+	}
+}
+
+/* Unlink the leaf of key from the tree and return it, NULL if key is not
+ * there. */
+static art_leaf *art_remove_leaf(art_tree *t, sds key)
+{
+	size_t klen = sdslen(key), depth = 0;
+	art_node **ref = &t->root, **child;
+	art_leaf *l;
+
+	while (*ref) {
+		art_node *n = *ref;
+
+		if (ART_IS_LEAF(n)) {
+			/* only the root is checked here, other leaves from their parent */
+			l = ART_LEAF(n);
+			if (!art_leaf_matches(l, key)) {
+				return NULL;
+			}
+			*ref = NULL;
+			return l;
+		}
+		if (n->plen) {
+			if (art_check_prefix(n, key, depth) != ART_MIN(n->plen, ART_MAX_PREFIX)) {
+				return NULL;
+			}
+			depth += n->plen;
+			if (depth > klen) {
+				return NULL;
+			}
+		}
+		if (depth == klen) {
+			if (!n->leaf || !art_leaf_matches(ART_LEAF(n->leaf), key)) {
+				return NULL;
+			}
+			l = ART_LEAF(n->leaf);
+			n->leaf = NULL;
+			if (n->type == ART_NODE4) {
+				art_compact4(t, (art_node4 *)n, ref);
+			}
+			return l;
+		}
+		child = art_find_child(n, key[depth]);
+		if (!child) {
+			return NULL;
+		}
+		if (ART_IS_LEAF(*child)) {
+			l = ART_LEAF(*child);
+			if (!art_leaf_matches(l, key)) {
+				return NULL;
+			}
+			art_remove_child(t, n, ref, key[depth], child);
+			return l;
+		}
+		ref = child;
+		depth++;
+	}
+	return NULL;
+}
+
+/* First leaf with a key >= key, NULL if there is none. Descends along key
+ * remembering the closest subtree on the right, whose minimum is the
+ * answer once key leaves the tree. */
+static art_leaf *art_lower_bound(art_tree *t, sds key)
+{
+	size_t klen = sdslen(key), depth = 0, i;
+	art_node *n = t->root, *right = NULL;
+	art_node **child;
+
+	while (n) {
+		if (ART_IS_LEAF(n)) {
+			art_leaf *l = ART_LEAF(n);
+			if (index_key_compare(ENTRY_KEY(&l->entry), key) >= 0) {
+				return l;
+			}
+			break;
+		}
+
+		if (n->plen) {
+			sds lkey = NULL;
+			for (i = 0; i < n->plen; i++) {
+				unsigned char c;
+				if (depth + i == klen) {
+					/* key is a prefix of everything below */
+					return art_minimum(n);
+				}
+				if (i < ART_MAX_PREFIX) {
+					c = n->prefix[i];
+				} else {
+					if (!lkey) {
+						lkey = ENTRY_KEY(&art_minimum(n)->entry);
+					}
+					c = lkey[depth + i];
+				}
+				if ((unsigned char)key[depth + i] < c) {
+					return art_minimum(n);
+				}
+				if ((unsigned char)key[depth + i] > c) {
+					goto right;
+				}
+			}
+			depth += n->plen;
+		}
+
+		if (depth == klen) {
+			return art_minimum(n);
+		}
+		/* n->leaf ends before key and is smaller */
+		art_node *next = art_next_child(n, key[depth]);
+		if (next) {
+			right = next;
+		}
+		child = art_find_child(n, key[depth]);
+		if (!child) {
+			break;
+		}
+		n = *child;
+		depth++;
+	}
+
+right:
+	return right ? art_minimum(right) : NULL;
+}
+
+static void *art_create(void)
+{
+	art_tree *t = zmalloc(sizeof(art_tree));
+
+	t->root = NULL;
+	t->head = t->tail = NULL;
+	t->size = 0;
+	t->nodes = 0;
+	t->arena = NULL;
+	return t;
+}
+
+static void art_free_node(art_tree *t, art_node *n)
+{
+	int i;
+
+	if (!n) {
+		return;
+	}
+	if (ART_IS_LEAF(n)) {
+		if (!t->arena) {
+			index_entry_free_val(&ART_LEAF(n)->entry);
+			free(ART_LEAF(n));
+		}
+		return;
+	}
+
+	art_free_node(t, n->leaf);
+	switch (n->type) {
+	case ART_NODE4:
+		for (i = 0; i < n->nchildren; i++) {
+			art_free_node(t, ((art_node4 *)n)->children[i]);
+		}
+		break;
+	case ART_NODE16:
+		for (i = 0; i < n->nchildren; i++) {
+			art_free_node(t, ((art_node16 *)n)->children[i]);
+		}
+		break;
+	case ART_NODE48:
+		for (i = 0; i < 48; i++) {
+			art_free_node(t, ((art_node48 *)n)->children[i]);
+		}
+		break;
+	case ART_NODE256:
+		for (i = 0; i < 256; i++) {
+			art_free_node(t, ((art_node256 *)n)->children[i]);
+		}
+		break;
+	}
+	zfree(n);
+}
+
+static void art_release(void *ptr)
+{
+	art_tree *t = ptr;
+
+	art_free_node(t, t->root);
+	slab_release(t->arena);
+	zfree(t);
+}
+
+static int art_use_slab(void *ptr, size_t klen, size_t vlen)
+{
+	art_tree *t = ptr;
+	size_t size = index_entry_prefix(ART_LEAF_HDR, klen) + vlen;
+
+	if (t->size != 0 || t->arena) {
+		return -1;
+	}
+
+	t->arena = slab_create(&size, 1);
+	return t->arena ? 0 : -1;
+}
+
+static index_entry *art_update(void *ptr, index_entry *e, const char *val, size_t vlen)
+{
+	art_tree *t = ptr;
+	art_leaf *l = (art_leaf *)e;
+	art_node **slot;
+	size_t prefix;
+
+	if (vlen <= e->vcap) {
+		index_entry_set_val(e, val, vlen);
+		return e;
+	}
+
+	/* slab slots have a fixed size */
+	if (t->arena) {
+		return NULL;
+	}
+
+	/* the leaf moves, repoint its slot and its neighbours */
+	slot = art_find_slot(t, ENTRY_KEY(e));
+	if (!slot) {
+		return NULL;
+	}
+	prefix = index_entry_prefix(ART_LEAF_HDR, sdslen(ENTRY_KEY(e)));
+	l = (art_leaf *)realloc(l, prefix + vlen);
+	if (!l) {
+		return NULL;
+	}
+	l->entry.vcap = malloc_usable_size(l) - prefix;
+	index_entry_set_val(&l->entry, val, vlen);
+	*slot = ART_TAG(l);
+	if (l->prev) {
+		l->prev->next = l;
+	} else {
+		t->head = l;
+	}
+	if (l->next) {
+		l->next->prev = l;
+	} else {
+		t->tail = l;
+	}
+	return &l->entry;
+}
+
+static index_entry *art_insert(void *ptr, sds key, const char *val, size_t vlen)
+{
+	art_tree *t = ptr;
+	art_leaf *l, *next;
+
+	next = art_lower_bound(t, key);
+	if (next && art_leaf_matches(next, key)) {
+		return art_update(t, &next->entry, val, vlen);
+	}
+
+	l = art_leaf_create(t, key, val, vlen);
+	if (!l) {
+		return NULL;
+	}
+	art_insert_leaf(t, l);
+
+	/* chain it in front of the first greater key */
+	l->next = next;
+	l->prev = next ? next->prev : t->tail;
+	if (l->prev) {
+		l->prev->next = l;
+	} else {
+		t->head = l;
+	}
+	if (next) {
+		next->prev = l;
+	} else {
+		t->tail = l;
+	}
+	t->size++;
+	return &l->entry;
+}
+
+static index_entry *art_lookup(void *ptr, sds key)
+{
+	art_node **slot = art_find_slot(ptr, key);
+
+	return slot ? &ART_LEAF(*slot)->entry : NULL;
+}
+
+static int art_delete(void *ptr, sds key)
+{
+	art_tree *t = ptr;
+	art_leaf *l = art_remove_leaf(t, key);
+
+	if (!l) {
+		return -1;
+	}
+
+	if (l->prev) {
+		l->prev->next = l->next;
+	} else {
+		t->head = l->next;
+	}
+	if (l->next) {
+		l->next->prev = l->prev;
+	} else {
+		t->tail = l->prev;
+	}
+	art_leaf_free(t, l);
+	t->size--;
+	return 0;
+}
+
+static unsigned long art_count(void *ptr)
+{
+	return ((art_tree *)ptr)->size;
+}
+
+/* Iterators point at a leaf, iteration follows the leaf chain. */
+static index_entry *art_iter_entry(index_iter *it, art_leaf *l)
+{
+	it->node = l;
+	return l ? &l->entry : NULL;
+}
+
+static index_entry *art_first(void *ptr, index_iter *it)
+{
+	return art_iter_entry(it, ((art_tree *)ptr)->head);
+}
+
+static index_entry *art_last(void *ptr, index_iter *it)
+{
+	return art_iter_entry(it, ((art_tree *)ptr)->tail);
+}
+
+static index_entry *art_seek(void *ptr, index_iter *it, sds key)
+{
+	return art_iter_entry(it, art_lower_bound(ptr, key));
+}
+
+static index_entry *art_next(void *ptr, index_iter *it)
+{
+	art_leaf *l = it->node;
+	(void)ptr;
+
+	return art_iter_entry(it, l ? l->next : NULL);
+}
+
+static index_entry *art_prev(void *ptr, index_iter *it)
+{
+	art_leaf *l = it->node;
+	(void)ptr;
+
+	return art_iter_entry(it, l ? l->prev : NULL);
+}
+
+static sds art_info(void *ptr, sds s)
+{
+	art_tree *t = ptr;
+
+	s = sdscatfmt(s, ",art_nodes=%U", (unsigned long long)t->nodes);
+	/* fixed-length mode: memory of the leaf slab arena */
+	if (t->arena) {
+		s = sdscatfmt(s, ",slab_used=%U,slab_allocated=%U",
+			(unsigned long long)slab_used_bytes(t->arena),
+			(unsigned long long)slab_allocated_bytes(t->arena));
+	}
+	return s;
+}
+
+index_type artIndexType = {
+	"art",
+	art_create,
+	art_release,
+	art_use_slab,
+	art_insert,
+	art_update,
+	art_lookup,
+	art_delete,
+	art_count,
+	art_first,
+	art_last,
+	art_seek,
+	art_next,
+	art_prev,
+	art_info,
+	NULL,
+	1
+};
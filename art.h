@@ -0,0 +1,72 @@
+#ifndef __ART_H__
+#define __ART_H__
+#include "sds.h"
+#include "slab.h"
+#include "index.h"
+#include <stdint.h>
+
+/* Adaptive Radix Tree. Inner nodes grow from 4 to 16, 48 and 256 children
+ * as they fill, and compress single child paths into a prefix of which the
+ * first ART_MAX_PREFIX bytes are stored; longer prefixes are checked against
+ * a leaf below the node. A key that ends inside the tree is kept in the
+ * 'leaf' slot of the node where it ends, so binary keys may be prefixes of
+ * one another.
+ *
+ * Leaves are the index entries themselves, tagged with the low pointer bit
+ * when stored as a child. They are also chained in key order so iteration
+ * never walks the tree. */
+#define ART_MAX_PREFIX 10
+
+#define ART_NODE4   1
+#define ART_NODE16  2
+#define ART_NODE48  3
+#define ART_NODE256 4
+
+typedef struct art_leaf {
+	index_entry entry;  /* must be first, callers see leaves as entries */
+	struct art_leaf *prev, *next;
+} art_leaf;
+
+typedef struct art_node {
+	uint8_t type;
+	uint16_t nchildren;
+	uint32_t plen;                          /* full length of the prefix */
+	unsigned char prefix[ART_MAX_PREFIX];
+	struct art_node *leaf;                  /* tagged leaf ending here */
+} art_node;
+
+typedef struct art_node4 {
+	art_node n;
+	unsigned char keys[4];
+	art_node *children[4];
+} art_node4;
+
+typedef struct art_node16 {
+	art_node n;
+	unsigned char keys[16];
+	art_node *children[16];
+} art_node16;
+
+/* index[c] is the slot of byte c in children plus one, 0 if absent */
+typedef struct art_node48 {
+	art_node n;
+	unsigned char index[256];
+	art_node *children[48];
+} art_node48;
+
+typedef struct art_node256 {
+	art_node n;
+	art_node *children[256];
+} art_node256;
+
+typedef struct art_tree {
+	art_node *root;
+	art_leaf *head, *tail;
+	unsigned long size;
+	unsigned long nodes;    /* inner nodes */
+	slab_arena *arena;      /* leaf slots in fixed-length mode, NULL to use malloc */
+} art_tree;
+
+extern index_type artIndexType;
+
+#endif
@@ -0,0 +1,618 @@
+#include "btree.h"
+#include "zmalloc.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#define BTREE_LEAF_MIN  (BTREE_LEAF_SIZE / 2)
+#define BTREE_INNER_MIN (BTREE_FANOUT / 2)
+#define BTREE_ENTRY_HDR sizeof(index_entry)
+
+/* Inner nodes walked from the root down to a leaf, with the child taken
+ * in each of them. */
+typedef struct bt_path {
+	int depth;
+	bt_inner *node[BTREE_MAX_HEIGHT];
+	int pos[BTREE_MAX_HEIGHT];
+} bt_path;
+
+static bt_leaf *bt_leaf_create(void)
+{
+	bt_leaf *leaf = zcalloc(sizeof(bt_leaf));
+
+	leaf->hdr.leaf = 1;
+	return leaf;
+}
+
+static bt_inner *bt_inner_create(void)
+{
+	bt_inner *in = zcalloc(sizeof(bt_inner));
+
+	in->hdr.leaf = 0;
+	return in;
+}
+
+/* Entries are allocated as in the skiplist, minus the level pointers. */
+static index_entry *bt_entry_create(btree *bt, sds key, const char *val, size_t vlen)
+{
+	size_t klen = sdslen(key);
+	size_t prefix = index_entry_prefix(BTREE_ENTRY_HDR, klen);
+	size_t vcap;
+	index_entry *e;
+
+	if (bt->arena) {
+		size_t slot = bt->arena->classes[0].size;
+		if (prefix + vlen > slot) {
+			return NULL;
+		}
+		e = (index_entry *)slab_alloc(bt->arena, 0);
+		if (!e) {
+			return NULL;
+		}
+		vcap = slot - prefix;
+	} else {
+		e = (index_entry *)malloc(prefix + vlen);
+		if (!e) {
+			return NULL;
+		}
+		vcap = malloc_usable_size(e) - prefix;
+	}
+
+	index_entry_init(e, BTREE_ENTRY_HDR, key, klen, val, vlen, vcap);
+	return e;
+}
+
+static void bt_entry_free(btree *bt, index_entry *e)
+{
+	if (bt->arena) {
+		slab_free(bt->arena, 0, e);
+	} else {
+		index_entry_free_val(e);
+		free(e);
+	}
+}
+
+/* Child of in that may hold key: the number of separators <= key. */
+static int bt_inner_pos(bt_inner *in, sds key)
+{
+	int lo = 0, hi = in->hdr.n - 1, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (index_key_compare(in->keys[mid], key) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/* First slot of leaf whose key is >= key, found is set on an exact match. */
+static int bt_leaf_pos(bt_leaf *leaf, sds key, int *found)
+{
+	int lo = 0, hi = leaf->hdr.n, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (index_key_compare(ENTRY_KEY(leaf->entries[mid]), key) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	*found = (lo < leaf->hdr.n &&
+			index_key_compare(ENTRY_KEY(leaf->entries[lo]), key) == 0);
+	return lo;
+}
+
+static bt_leaf *bt_descend(btree *bt, sds key, bt_path *path)
+{
+	bt_node *node = bt->root;
+
+	path->depth = 0;
+	while (!node->leaf) {
+		bt_inner *in = (bt_inner *)node;
+		int pos = bt_inner_pos(in, key);
+
+		path->node[path->depth] = in;
+		path->pos[path->depth] = pos;
+		path->depth++;
+		node = in->children[pos];
+	}
+	return (bt_leaf *)node;
+}
+
+static void *bt_create(void)
+{
+	btree *bt = zmalloc(sizeof(btree));
+	bt_leaf *leaf = bt_leaf_create();
+
+	bt->root = (bt_node *)leaf;
+	bt->first = bt->last = leaf;
+	bt->count = 0;
+	bt->height = 1;
+	bt->arena = NULL;
+	return bt;
+}
+
+static void bt_free_node(btree *bt, bt_node *node)
+{
+	int i;
+
+	if (node->leaf) {
+		bt_leaf *leaf = (bt_leaf *)node;
+		if (!bt->arena) {
+			for (i = 0; i < leaf->hdr.n; i++) {
+				index_entry_free_val(leaf->entries[i]);
+				free(leaf->entries[i]);
+			}
+		}
+	} else {
+		bt_inner *in = (bt_inner *)node;
+		for (i = 0; i < in->hdr.n; i++) {
+			bt_free_node(bt, in->children[i]);
+		}
+		for (i = 0; i < in->hdr.n - 1; i++) {
+			sdsfree(in->keys[i]);
+		}
+	}
+	zfree(node);
+}
+
+static void bt_release(void *ptr)
+{
+	btree *bt = ptr;
+
+	bt_free_node(bt, bt->root);
+	slab_release(bt->arena);
+	zfree(bt);
+}
+
+static int bt_use_slab(void *ptr, size_t klen, size_t vlen)
+{
+	btree *bt = ptr;
+	size_t size = index_entry_prefix(BTREE_ENTRY_HDR, klen) + vlen;
+
+	if (bt->count != 0 || bt->arena) {
+		return -1;
+	}
+
+	bt->arena = slab_create(&size, 1);
+	return bt->arena ? 0 : -1;
+}
+
+/* Put sep/right after children[pos] of the inner node at depth d of the
+ * path, splitting full nodes up to the root. */
+static void bt_inner_insert(btree *bt, bt_path *path, int d, sds sep, bt_node *right)
+{
+	sds keys[BTREE_FANOUT];
+	bt_node *children[BTREE_FANOUT + 1];
+
+	for (; d >= 0; d--) {
+		bt_inner *in = path->node[d], *sib;
+		int pos = path->pos[d], n = in->hdr.n, left;
+
+		if (n < BTREE_FANOUT) {
+			memmove(in->keys + pos + 1, in->keys + pos, (n - 1 - pos) * sizeof(sds));
+			memmove(in->children + pos + 2, in->children + pos + 1,
+					(n - 1 - pos) * sizeof(bt_node *));
+			in->keys[pos] = sep;
+			in->children[pos + 1] = right;
+			in->hdr.n++;
+			return;
+		}
+
+		/* lay out the n + 1 children, then give half of them to a sibling
+		 * and push the separator between the halves up */
+		memcpy(keys, in->keys, pos * sizeof(sds));
+		keys[pos] = sep;
+		memcpy(keys + pos + 1, in->keys + pos, (n - 1 - pos) * sizeof(sds));
+		memcpy(children, in->children, (pos + 1) * sizeof(bt_node *));
+		children[pos + 1] = right;
+		memcpy(children + pos + 2, in->children + pos + 1, (n - 1 - pos) * sizeof(bt_node *));
+
+		left = (n + 1) / 2;
+		sib = bt_inner_create();
+		in->hdr.n = left;
+		memcpy(in->keys, keys, (left - 1) * sizeof(sds));
+		memcpy(in->children, children, left * sizeof(bt_node *));
+		sib->hdr.n = n + 1 - left;
+		memcpy(sib->keys, keys + left, (sib->hdr.n - 1) * sizeof(sds));
+		memcpy(sib->children, children + left, sib->hdr.n * sizeof(bt_node *));
+
+		sep = keys[left - 1];
+		right = (bt_node *)sib;
+	}
+
+	/* the root was split, grow the tree by one level */
+	bt_inner *root = bt_inner_create();
+	root->hdr.n = 2;
+	root->keys[0] = sep;
+	root->children[0] = bt->root;
+	root->children[1] = right;
+	bt->root = (bt_node *)root;
+	bt->height++;
+}
+
+static void bt_leaf_insert_at(bt_leaf *leaf, int pos, index_entry *e)
+{
+	memmove(leaf->entries + pos + 1, leaf->entries + pos,
+			(leaf->hdr.n - pos) * sizeof(index_entry *));
+	leaf->entries[pos] = e;
+	leaf->hdr.n++;
+}
+
+/* Set the value of the entry at slot pos of leaf, reallocating it when the
+ * value does not fit. */
+static index_entry *bt_set_val(btree *bt, bt_leaf *leaf, int pos, const char *val, size_t vlen)
+{
+	index_entry *e = leaf->entries[pos];
+	size_t prefix;
+
+	if (vlen <= e->vcap) {
+		index_entry_set_val(e, val, vlen);
+		return e;
+	}
+
+	/* slab slots have a fixed size */
+	if (bt->arena) {
+		return NULL;
+	}
+
+	prefix = index_entry_prefix(BTREE_ENTRY_HDR, sdslen(ENTRY_KEY(e)));
+	e = (index_entry *)realloc(e, prefix + vlen);
+	if (!e) {
+		return NULL;
+	}
+	e->vcap = malloc_usable_size(e) - prefix;
+	index_entry_set_val(e, val, vlen);
+	leaf->entries[pos] = e;
+	return e;
+}
+
+static index_entry *bt_insert(void *ptr, sds key, const char *val, size_t vlen)
+{
+	btree *bt = ptr;
+	bt_path path;
+	bt_leaf *leaf, *right;
+	index_entry *e;
+	int pos, found, half;
+
+	leaf = bt_descend(bt, key, &path);
+	pos = bt_leaf_pos(leaf, key, &found);
+	if (found) {
+		return bt_set_val(bt, leaf, pos, val, vlen);
+	}
+
+	e = bt_entry_create(bt, key, val, vlen);
+	if (!e) {
+		return NULL;
+	}
+
+	if (leaf->hdr.n < BTREE_LEAF_SIZE) {
+		bt_leaf_insert_at(leaf, pos, e);
+	} else {
+		/* split the full leaf in two and chain the new one after it */
+		half = BTREE_LEAF_SIZE / 2;
+		right = bt_leaf_create();
+		right->hdr.n = BTREE_LEAF_SIZE - half;
+		memcpy(right->entries, leaf->entries + half, right->hdr.n * sizeof(index_entry *));
+		leaf->hdr.n = half;
+
+		right->prev = leaf;
+		right->next = leaf->next;
+		if (leaf->next) {
+			leaf->next->prev = right;
+		} else {
+			bt->last = right;
+		}
+		leaf->next = right;
+
+		if (pos <= half) {
+			bt_leaf_insert_at(leaf, pos, e);
+		} else {
+			bt_leaf_insert_at(right, pos - half, e);
+		}
+		bt_inner_insert(bt, &path, path.depth - 1,
+				sdsdup(ENTRY_KEY(right->entries[0])), (bt_node *)right);
+	}
+
+	bt->count++;
+	return e;
+}
+
+static index_entry *bt_update(void *ptr, index_entry *e, const char *val, size_t vlen)
+{
+	btree *bt = ptr;
+	bt_path path;
+	bt_leaf *leaf;
+	int pos, found;
+
+	if (vlen <= e->vcap) {
+		index_entry_set_val(e, val, vlen);
+		return e;
+	}
+
+	/* the entry moves, find the slot pointing to it */
+	leaf = bt_descend(bt, ENTRY_KEY(e), &path);
+	pos = bt_leaf_pos(leaf, ENTRY_KEY(e), &found);
+	if (!found) {
+		return NULL;
+	}
+	return bt_set_val(bt, leaf, pos, val, vlen);
+}
+
+static index_entry *bt_lookup(void *ptr, sds key)
+{
+	btree *bt = ptr;
+	bt_path path;
+	bt_leaf *leaf;
+	int pos, found;
+
+	leaf = bt_descend(bt, key, &path);
+	pos = bt_leaf_pos(leaf, key, &found);
+	return found ? leaf->entries[pos] : NULL;
+}
+
+/* Merge children[i + 1] of parent into children[i]. */
+static void bt_merge(btree *bt, bt_inner *parent, int i)
+{
+	bt_node *l = parent->children[i], *r = parent->children[i + 1];
+
+	if (l->leaf) {
+		bt_leaf *left = (bt_leaf *)l, *right = (bt_leaf *)r;
+
+		memcpy(left->entries + left->hdr.n, right->entries,
+				right->hdr.n * sizeof(index_entry *));
+		left->hdr.n += right->hdr.n;
+		left->next = right->next;
+		if (right->next) {
+			right->next->prev = left;
+		} else {
+			bt->last = left;
+		}
+		sdsfree(parent->keys[i]);
+	} else {
+		bt_inner *left = (bt_inner *)l, *right = (bt_inner *)r;
+
+		/* the separator comes down between the two key sets */
+		left->keys[left->hdr.n - 1] = parent->keys[i];
+		memcpy(left->keys + left->hdr.n, right->keys, (right->hdr.n - 1) * sizeof(sds));
+		memcpy(left->children + left->hdr.n, right->children,
+				right->hdr.n * sizeof(bt_node *));
+		left->hdr.n += right->hdr.n;
+	}
+	zfree(r);
+
+	memmove(parent->keys + i, parent->keys + i + 1,
+			(parent->hdr.n - 2 - i) * sizeof(sds));
+	memmove(parent->children + i + 1, parent->children + i + 2,
+			(parent->hdr.n - 2 - i) * sizeof(bt_node *));
+	parent->hdr.n--;
+}
+
+/* Move the last slot of children[pos - 1] in front of children[pos]. */
+static void bt_borrow_left(bt_inner *parent, int pos)
+{
+	bt_node *l = parent->children[pos - 1], *n = parent->children[pos];
+
+	if (n->leaf) {
+		bt_leaf *left = (bt_leaf *)l, *node = (bt_leaf *)n;
+
+		bt_leaf_insert_at(node, 0, left->entries[left->hdr.n - 1]);
+		left->hdr.n--;
+		sdsfree(parent->keys[pos - 1]);
+		parent->keys[pos - 1] = sdsdup(ENTRY_KEY(node->entries[0]));
+	} else {
+		bt_inner *left = (bt_inner *)l, *node = (bt_inner *)n;
+
+		memmove(node->keys + 1, node->keys, (node->hdr.n - 1) * sizeof(sds));
+		memmove(node->children + 1, node->children, node->hdr.n * sizeof(bt_node *));
+		node->keys[0] = parent->keys[pos - 1];
+		node->children[0] = left->children[left->hdr.n - 1];
+		node->hdr.n++;
+		parent->keys[pos - 1] = left->keys[left->hdr.n - 2];
+		left->hdr.n--;
+	}
+}
+
+/* Move the first slot of children[pos + 1] after children[pos]. */
+static void bt_borrow_right(bt_inner *parent, int pos)
+{
+	bt_node *n = parent->children[pos], *r = parent->children[pos + 1];
+
+	if (n->leaf) {
+		bt_leaf *node = (bt_leaf *)n, *right = (bt_leaf *)r;
+
+		node->entries[node->hdr.n++] = right->entries[0];
+		memmove(right->entries, right->entries + 1,
+				(right->hdr.n - 1) * sizeof(index_entry *));
+		right->hdr.n--;
+		sdsfree(parent->keys[pos]);
+		parent->keys[pos] = sdsdup(ENTRY_KEY(right->entries[0]));
+	} else {
+		bt_inner *node = (bt_inner *)n, *right = (bt_inner *)r;
+
+		node->keys[node->hdr.n - 1] = parent->keys[pos];
+		node->children[node->hdr.n] = right->children[0];
+		node->hdr.n++;
+		parent->keys[pos] = right->keys[0];
+		memmove(right->keys, right->keys + 1, (right->hdr.n - 2) * sizeof(sds));
+		memmove(right->children, right->children + 1,
+				(right->hdr.n - 1) * sizeof(bt_node *));
+		right->hdr.n--;
+	}
+}
+
+/* Restore the minimum fill of node, the last node of path, by borrowing
+ * from or merging with a sibling, walking up while parents underflow. */
+static void bt_rebalance(btree *bt, bt_path *path, bt_node *node)
+{
+	int d, pos, min;
+
+	for (d = path->depth - 1; d >= 0; d--) {
+		bt_inner *parent = path->node[d];
+
+		min = node->leaf ? BTREE_LEAF_MIN : BTREE_INNER_MIN;
+		if (node->n >= min) {
+			return;
+		}
+
+		pos = path->pos[d];
+		if (pos > 0 && parent->children[pos - 1]->n > min) {
+			bt_borrow_left(parent, pos);
+			return;
+		} else if (pos < parent->hdr.n - 1 && parent->children[pos + 1]->n > min) {
+			bt_borrow_right(parent, pos);
+			return;
+		}
+
+		bt_merge(bt, parent, pos > 0 ? pos - 1 : pos);
+		node = (bt_node *)parent;
+	}
+
+	/* an inner root left with a single child is replaced by it */
+	if (!node->leaf && node->n == 1) {
+		bt->root = ((bt_inner *)node)->children[0];
+		bt->height--;
+		zfree(node);
+	}
+}
+
+static int bt_delete(void *ptr, sds key)
+{
+	btree *bt = ptr;
+	bt_path path;
+	bt_leaf *leaf;
+	int pos, found;
+
+	leaf = bt_descend(bt, key, &path);
+	pos = bt_leaf_pos(leaf, key, &found);
+	if (!found) {
+		return -1;
+	}
+
+	bt_entry_free(bt, leaf->entries[pos]);
+	memmove(leaf->entries + pos, leaf->entries + pos + 1,
+			(leaf->hdr.n - 1 - pos) * sizeof(index_entry *));
+	leaf->hdr.n--;
+	bt->count--;
+
+	bt_rebalance(bt, &path, (bt_node *)leaf);
+	return 0;
+}
+
+static unsigned long bt_count(void *ptr)
+{
+	return ((btree *)ptr)->count;
+}
+
+/* Iterators point at a leaf and a slot in it. */
+static index_entry *bt_iter_entry(index_iter *it)
+{
+	bt_leaf *leaf = it->node;
+
+	if (!leaf || it->pos < 0 || it->pos >= leaf->hdr.n) {
+		it->node = NULL;
+		return NULL;
+	}
+	return leaf->entries[it->pos];
+}
+
+static index_entry *bt_first(void *ptr, index_iter *it)
+{
+	it->node = ((btree *)ptr)->first;
+	it->pos = 0;
+	return bt_iter_entry(it);
+}
+
+static index_entry *bt_last(void *ptr, index_iter *it)
+{
+	bt_leaf *leaf = ((btree *)ptr)->last;
+
+	it->node = leaf;
+	it->pos = leaf->hdr.n - 1;
+	return bt_iter_entry(it);
+}
+
+static index_entry *bt_seek(void *ptr, index_iter *it, sds key)
+{
+	bt_path path;
+	bt_leaf *leaf;
+	int found;
+
+	leaf = bt_descend(ptr, key, &path);
+	it->node = leaf;
+	it->pos = bt_leaf_pos(leaf, key, &found);
+	/* every key of this leaf is smaller, start from the next one */
+	if (it->pos == leaf->hdr.n && leaf->next) {
+		it->node = leaf->next;
+		it->pos = 0;
+	}
+	return bt_iter_entry(it);
+}
+
+static index_entry *bt_next(void *ptr, index_iter *it)
+{
+	bt_leaf *leaf = it->node;
+	(void)ptr;
+
+	if (!leaf) {
+		return NULL;
+	}
+	if (++it->pos >= leaf->hdr.n) {
+		it->node = leaf->next;
+		it->pos = 0;
+	}
+	return bt_iter_entry(it);
+}
+
+static index_entry *bt_prev(void *ptr, index_iter *it)
+{
+	bt_leaf *leaf = it->node;
+	(void)ptr;
+
+	if (!leaf) {
+		return NULL;
+	}
+	if (--it->pos < 0) {
+		leaf = leaf->prev;
+		it->node = leaf;
+		it->pos = leaf ? leaf->hdr.n - 1 : 0;
+	}
+	return bt_iter_entry(it);
+}
+
+static sds bt_info(void *ptr, sds s)
+{
+	btree *bt = ptr;
+
+	s = sdscatfmt(s, ",btree_height=%i", bt->height);
+	/* fixed-length mode: memory of the entry slab arena */
+	if (bt->arena) {
+		s = sdscatfmt(s, ",slab_used=%U,slab_allocated=%U",
+			(unsigned long long)slab_used_bytes(bt->arena),
+			(unsigned long long)slab_allocated_bytes(bt->arena));
+	}
+	return s;
+}
+
+index_type btreeIndexType = {
+	"btree",
+	bt_create,
+	bt_release,
+	bt_use_slab,
+	bt_insert,
+	bt_update,
+	bt_lookup,
+	bt_delete,
+	bt_count,
+	bt_first,
+	bt_last,
+	bt_seek,
+	bt_next,
+	bt_prev,
+	bt_info
+};
@@ -0,0 +1,42 @@
+#ifndef __BTREE_H__
+#define __BTREE_H__
+#include "sds.h"
+#include "slab.h"
+#include "index.h"
+
+/* In-memory B+tree. Leaves are wide arrays of entry pointers chained in
+ * key order, so a range scan walks contiguous memory instead of chasing
+ * one pointer per key. Inner nodes hold copies of their separator keys,
+ * keys[i] being the smallest key that can be found under children[i+1]. */
+#define BTREE_LEAF_SIZE 64
+#define BTREE_FANOUT    64
+#define BTREE_MAX_HEIGHT 16
+
+typedef struct bt_node {
+	int leaf;
+	int n;      /* entries of a leaf, children of an inner node */
+} bt_node;
+
+typedef struct bt_leaf {
+	bt_node hdr;
+	struct bt_leaf *prev, *next;
+	index_entry *entries[BTREE_LEAF_SIZE];
+} bt_leaf;
+
+typedef struct bt_inner {
+	bt_node hdr;
+	sds keys[BTREE_FANOUT - 1];
+	bt_node *children[BTREE_FANOUT];
+} bt_inner;
+
+typedef struct btree {
+	bt_node *root;
+	bt_leaf *first, *last;
+	unsigned long count;
+	int height;         /* 1 when the root is a leaf */
+	slab_arena *arena;  /* entry slots in fixed-length mode, NULL to use malloc */
+} btree;
+
+extern index_type btreeIndexType;
+
+#endif
@@ -3,7 +3,10 @@
 #include "log.h"
 #include "sds.h"
 #include "db.h"
-#include "skiplist.h"
+#include "index.h"
+#include "util.h"
+#include "shard.h"
+#include "snapshot.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -28,7 +31,13 @@ static void shutdownCommand(client *c);
 static int getCommand(client *c);
 static int putCommand(client *c);
 static void deleteCommand(client *c);
+static void mgetCommand(client *c);
+static void mputCommand(client *c);
+static void mdeleteCommand(client *c);
 static void scanCommand(client *c);
+static void rscanCommand(client *c);
+static void countCommand(client *c);
+static void rankCommand(client *c);
 
 /* Migrate cache dict type. */
 dictType commandTableDictType = {
@@ -42,15 +51,21 @@ dictType commandTableDictType = {
 
 
 struct server_command server_commands_table[] = {
-	{"get",      getCommand,       2}, 
-	{"put",	     putCommand,       3}, 
-	{"set",	     putCommand,       3}, 
-	{"delete",   deleteCommand,    2}, 
-	{"scan",     scanCommand,      3},
-	{"ping",     pingCommand,      1},
-	{"shutdown", shutdownCommand,  1},
-	{"show",     infoCommand,      1},
-	{NULL,       NULL,             0}, 
+	{"get",      getCommand,       2, CMD_KEY},
+	{"put",      putCommand,       3, CMD_WRITE|CMD_KEY},
+	{"set",      putCommand,       3, CMD_WRITE|CMD_KEY},
+	{"delete",   deleteCommand,    2, CMD_WRITE|CMD_KEY},
+	{"mget",     mgetCommand,     -2, 0},
+	{"mput",     mputCommand,     -3, CMD_WRITE},
+	{"mdelete",  mdeleteCommand,  -2, CMD_WRITE},
+	{"scan",     scanCommand,     -3, 0},
+	{"rscan",    rscanCommand,    -3, 0},
+	{"count",    countCommand,     3, 0},
+	{"rank",     rankCommand,      2, 0},
+	{"ping",     pingCommand,      1, 0},
+	{"shutdown", shutdownCommand,  1, 0},
+	{"show",     infoCommand,      1, 0},
+	{NULL,       NULL,             0, 0},
 };
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -65,6 +80,8 @@ void populateCommandTable()
 		assert(retval == DICT_OK);
 		ptr++;
 	}
+	/* the shards look commands up at once, a lookup must not rehash */
+	while (dictRehash(server.commands, 100));
 
 	return;
 }
@@ -105,6 +122,36 @@ static void pingCommand(client *c)
 	return;
 }
 
+/* Reply the value of key, nil if it does not exist. A key of another shard
+ * is read in place, see shardReadsInPlace(): its value is copied before
+ * the read section ends, the entry may be freed after it. */
+static void addReplyValue(client *c, sds key)
+{
+	int shard = server.shard_num > 1 ? shardOfKey(key) : serverTL->id;
+	ordered_index *idx;
+	index_entry *e;
+
+	if (shard == serverTL->id) {
+		e = lookupKey(key);
+		if (e == NULL) {
+			addReply(c, NULLBULK);
+		} else {
+			addReplyBulkRef(c, ENTRY_VAL(e), e->vlen);
+		}
+		return;
+	}
+
+	idx = server.shards[shard].idx;
+	index_read_begin(idx);
+	e = index_lookup(idx, key);
+	if (e == NULL) {
+		addReply(c, NULLBULK);
+	} else {
+		addReplyBulkCBuffer(c, ENTRY_VAL(e), e->vlen);
+	}
+	index_read_end(idx);
+}
+
 static int getCommand(client *c)
 {
 	/* check key length */
@@ -116,22 +163,12 @@ static int getCommand(client *c)
 		}
 	}
 
-	/* search from dict */
-	if (dictFind(server.dict, c->argv[1]) == NULL) {
-		addReply(c, NULLBULK);
-		return 0;
-	}
-
-	sds res = search_skiplist(server.sl, c->argv[1]);
-
-	addReply(c, convertToResp(res));
+	addReplyValue(c, c->argv[1]);
 	return 0;
 }
 
 static int putCommand(client *c)
 {
-	dictEntry *de;
-
 	/* check key/value length */
 	if (server.fl) {
 		if (sdslen(c->argv[1]) != server.fl->key_len || 
@@ -142,16 +179,11 @@ static int putCommand(client *c)
 		}
 	}
 
-	de = dictFind(server.dict, c->argv[1]);
-	if (de) {
-		/* if kv already exists, just replace ziplist node */
-		replace_skiplist(server.sl, c->argv[1], c->argv[2]);
-	} else {
-		/* just add raw key to dict */
-		dictAddRaw(server.dict, sdsdup(c->argv[1]));	
-		/* insert into skiplist */
-		insert_skiplist(server.sl, c->argv[1], c->argv[2]);
+	if (setKeyMove(c->argv[1], c->argv[2]) == SERVER_ERR) {
+		addReplyErrorFormat(c, "out of memory");
+		return 0;
 	}
+	c->argv[2] = NULL;
 
 	addReply(c, OK);
 	return 0;
@@ -168,13 +200,9 @@ static void deleteCommand(client *c)
 		}
 	}
 
-	dictEntry *de;
-	de = dictFind(server.dict, c->argv[1]);
-	if (!de) {
+	if (deleteKey(c->argv[1]) == SERVER_ERR) {
 		addReply(c, sdsnew("+0\r\n"));
 	} else {
-		delete_skiplist(server.sl, c->argv[1]);
-		dictDelete(server.dict, c->argv[1]);
 		addReply(c, sdsnew("+1\r\n"));
 	}
 	
@@ -182,11 +210,237 @@ static void deleteCommand(client *c)
 	return;
 }
 
-static void scanCommand(client *c)
+/* Return 1 if every key in argv[first..] (every other one when step is 2)
+ * has the fixed length, otherwise reply an error and return 0. */
+static int checkKeysLength(client *c, int first, int step)
 {
-	sds start = c->argv[1];
-	sds end = c->argv[2];
+	int j;
+
+	if (!server.fl) {
+		return 1;
+	}
+	for (j = first; j < c->argc; j += step) {
+		if (sdslen(c->argv[j]) != server.fl->key_len) {
+			addReplyErrorFormat(c, "Illegal key length, key length should be %ld", 
+									server.fl->key_len);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Run a job for c over the shards owning the keys in argv[first..], every
+ * other one when step is 2. Shards in between visit the job too. */
+static void runKeysJob(client *c, int first, int step, shardJobProc *proc,
+		shardJobProc *done, void *privdata)
+{
+	int j, shard, lo = server.shard_num, hi = -1;
+	shardJob *job;
+
+	for (j = first; j < c->argc; j += step) {
+		shard = shardOfKey(c->argv[j]);
+		if (shard < lo) lo = shard;
+		if (shard > hi) hi = shard;
+	}
+	job = shardCreateJob(c, lo, hi, proc, done);
+	job->privdata = privdata;
+	shardRunJob(job);
+}
+
+/* Every shard copies the values of its keys, the client's shard replies
+ * in argument order. */
+static void mgetShardProc(shardJob *job)
+{
+	client *c = job->c;
+	sds *vals = job->privdata;
+	index_entry *e;
+	int j;
+
+	for (j = 1; j < c->argc; j++) {
+		if (shardOfKey(c->argv[j]) != serverTL->id) continue;
+		e = lookupKey(c->argv[j]);
+		if (e) vals[j] = sdsnewlen(ENTRY_VAL(e), e->vlen);
+	}
+}
+
+static void mgetShardDone(shardJob *job)
+{
+	client *c = job->c;
+	sds *vals = job->privdata;
+	int j;
+
+	addReply(c, sdscatfmt(sdsempty(), "*%i\r\n", c->argc - 1));
+	for (j = 1; j < c->argc; j++) {
+		if (vals[j] == NULL) {
+			addReplyString(c, "$-1\r\n", 5);
+			continue;
+		}
+		addReply(c, sdscatfmt(sdsempty(), "$%u\r\n", (unsigned int)sdslen(vals[j])));
+		addReplyString(c, vals[j], sdslen(vals[j]));
+		addReplyString(c, "\r\n", 2);
+		sdsfree(vals[j]);
+	}
+	zfree(vals);
+}
+
+/* mget key [key ...]: array of values, nil for missing keys */
+static void mgetCommand(client *c)
+{
+	int j;
+
+	if (!checkKeysLength(c, 1, 1)) {
+		return;
+	}
+	if (server.shard_num > 1 && !shardReadsInPlace()) {
+		runKeysJob(c, 1, 1, mgetShardProc, mgetShardDone,
+				zcalloc(sizeof(sds) * c->argc));
+		return;
+	}
+
+	addReply(c, sdscatfmt(sdsempty(), "*%i\r\n", c->argc - 1));
+	for (j = 1; j < c->argc; j++) {
+		addReplyValue(c, c->argv[j]);
+	}
+}
+
+typedef struct kvPair {
+	sds key;
+	sds val;
+	int pos;    /* argv index of the value, the last one of a key wins */
+} kvPair;
+
+static int kvPairCompare(const void *a, const void *b)
+{
+	const kvPair *p1 = a, *p2 = b;
+	int cmp = index_key_compare(p1->key, p2->key);
+
+	return cmp ? cmp : p1->pos - p2->pos;
+}
 
+/* Set the pairs of mput whose key belongs to shard, all of them if it is
+ * -1. They are applied in key order, so that an index keeping a search
+ * finger only walks from one key to the next. Pairs applied before an out
+ * of memory error are kept. */
+static int mputPairs(client *c, int shard)
+{
+	int j, n = 0;
+	kvPair *pairs = zmalloc(sizeof(kvPair) * ((c->argc - 1) / 2));
+
+	for (j = 1; j < c->argc; j += 2) {
+		if (shard != -1 && shardOfKey(c->argv[j]) != shard) continue;
+		pairs[n].key = c->argv[j];
+		pairs[n].val = c->argv[j + 1];
+		pairs[n].pos = j + 1;
+		n++;
+	}
+	qsort(pairs, n, sizeof(kvPair), kvPairCompare);
+
+	for (j = 0; j < n; j++) {
+		if (setKeyMove(pairs[j].key, pairs[j].val) == SERVER_ERR) {
+			zfree(pairs);
+			return SERVER_ERR;
+		}
+		c->argv[pairs[j].pos] = NULL;
+	}
+	zfree(pairs);
+	return SERVER_OK;
+}
+
+static void mputShardProc(shardJob *job)
+{
+	if (mputPairs(job->c, serverTL->id) == SERVER_ERR) {
+		job->count = -1;
+		job->finished = 1;
+	}
+}
+
+static void mputShardDone(shardJob *job)
+{
+	if (job->count == -1) {
+		addReplyErrorFormat(job->c, "out of memory");
+	} else {
+		addReply(job->c, OK);
+	}
+}
+
+/* mput key value [key value ...] */
+static void mputCommand(client *c)
+{
+	int j;
+
+	if (c->argc % 2 == 0) {
+		addReplyErrorFormat(c, "wrong number of arguments for 'mput' command");
+		return;
+	}
+	if (!checkKeysLength(c, 1, 2)) {
+		return;
+	}
+	if (server.fl) {
+		for (j = 2; j < c->argc; j += 2) {
+			if (sdslen(c->argv[j]) != server.fl->val_len) {
+				addReplyErrorFormat(c, "Illegal kv length, key/value length should be %ld/%ld", 
+										server.fl->key_len, server.fl->val_len);
+				return;
+			}
+		}
+	}
+
+	if (server.shard_num > 1) {
+		runKeysJob(c, 1, 2, mputShardProc, mputShardDone, NULL);
+		return;
+	}
+
+	if (mputPairs(c, -1) == SERVER_ERR) {
+		addReplyErrorFormat(c, "out of memory");
+		return;
+	}
+	addReply(c, OK);
+}
+
+/* Remove the keys of mdelete that belong to shard, all of them if it is
+ * -1. Return how many existed. */
+static long long mdeleteKeys(client *c, int shard)
+{
+	long long deleted = 0;
+	int j;
+
+	for (j = 1; j < c->argc; j++) {
+		if (shard != -1 && shardOfKey(c->argv[j]) != shard) continue;
+		if (deleteKey(c->argv[j]) == SERVER_OK) {
+			deleted++;
+		}
+	}
+	return deleted;
+}
+
+static void mdeleteShardProc(shardJob *job)
+{
+	job->count += mdeleteKeys(job->c, serverTL->id);
+}
+
+static void addReplyCount(shardJob *job)
+{
+	addReply(job->c, sdscatfmt(sdsempty(), ":%I\r\n", job->count));
+}
+
+/* mdelete key [key ...]: number of keys removed */
+static void mdeleteCommand(client *c)
+{
+	if (!checkKeysLength(c, 1, 1)) {
+		return;
+	}
+	if (server.shard_num > 1) {
+		runKeysJob(c, 1, 1, mdeleteShardProc, addReplyCount, NULL);
+		return;
+	}
+
+	addReply(c, sdscatfmt(sdsempty(), ":%I\r\n", mdeleteKeys(c, -1)));
+}
+
+/* Return 1 if [start, end] is a range scan and count accept, otherwise
+ * reply an error and return 0. */
+static int checkRange(client *c, sds start, sds end)
+{
 	/* check key length */
 	if (server.fl) {
 		if (sdslen(start) != server.fl->key_len || 
@@ -198,31 +452,419 @@ static void scanCommand(client *c)
 	}
 
 	/* check start/end cursor */
-	if (slKeyCompare(start, end) > 0) {
+	if (index_key_compare(start, end) > 0) {
 		addReplyErrorFormat(c, "CURSORERR '%s' should less or equal to '%s'", start, end);
+		return 0;
+	}
+	return 1;
+}
+
+typedef struct scanState {
+	sds start, end;         /* the range, later slices do not read argv */
+	int reverse;
+	int withvalues;
+	int counting;           /* first pass of a scan without LIMIT */
+	int expired;            /* the snapshot got too old, see snapshotExpired() */
+	long long limit;        /* -1 without LIMIT */
+	unsigned long numkeys;  /* keys counted, then keys added */
+	sds keys;               /* the reply not sent yet */
+	sds cursor;             /* first key left out of the page, if any */
+	sds resume;             /* where the next slice starts in the shard */
+	snapshot *snap;         /* view of a scan spanning ticks or shards */
+} scanState;
+
+#define SCAN_DONE 0         /* the range is exhausted in this shard */
+#define SCAN_FULL 1         /* the page is full, the key is its cursor */
+#define SCAN_YIELD 2        /* the slice is over, the key starts the next */
+
+static sds catBulk(sds s, const char *p, size_t len)
+{
+	s = sdscatfmt(s, "$%U\r\n", (unsigned long long)len);
+	s = sdscatlen(s, p, len);
+	return sdscatlen(s, "\r\n", 2);
+}
+
+/* Add the current pair of it to the reply. On the shard of the client the
+ * live pairs are referenced, see addReplyBulkRef(), the ones saved by a
+ * snapshot are copied, as is everything built in other shards. */
+static void scanAddPair(scanState *st, client *c, snapshotIter *it)
+{
+	if (c == NULL) {
+		st->keys = catBulk(st->keys, it->key, sdslen(it->key));
+		if (st->withvalues) st->keys = catBulk(st->keys, it->val, it->vlen);
+	} else if (it->entry) {
+		addReplyBulkRef(c, it->key, sdslen(it->key));
+		if (st->withvalues) addReplyBulkRef(c, it->val, it->vlen);
+	} else {
+		addReplyBulkCBuffer(c, it->key, sdslen(it->key));
+		if (st->withvalues) addReplyBulkCBuffer(c, it->val, it->vlen);
+	}
+}
+
+/* Count or add the keys of the calling shard in [start, end], as long as
+ * the page is not full and at most SCAN_SLICE_KEYS of them. They are added
+ * to c if not NULL, to st->keys otherwise, and without LIMIT only until
+ * SCAN_REPLY_PENDING_MAX bytes wait to be sent. On SCAN_FULL and SCAN_YIELD
+ * *key is set to the first key left out. */
+static int scanShard(scanState *st, client *c, sds start, sds end, sds *key)
+{
+	snapshotIter it;
+	int more, n = 0;
+
+	/* seek to the first key of the range and stop at the first one past
+	 * its other end */
+	more = snapshotSeek(&it, st->snap, st->reverse ? end : start, st->reverse);
+	while (more) {
+		*key = it.key;
+		if (st->reverse ? index_key_compare(*key, start) < 0 :
+				index_key_compare(*key, end) > 0) {
+			return SCAN_DONE;
+		}
+		/* a page is built whole before it is sent, it ends early rather
+		 * than grow past SCAN_REPLY_PENDING_MAX */
+		if (st->limit != -1 && (st->numkeys == (unsigned long)st->limit ||
+					sdslen(st->keys) > SCAN_REPLY_PENDING_MAX)) {
+			return SCAN_FULL;
+		}
+		if (n++ == SCAN_SLICE_KEYS) {
+			return SCAN_YIELD;
+		}
+		if (st->limit == -1 && (c ? c->reply_bytes :
+					sdslen(st->keys)) > SCAN_REPLY_PENDING_MAX) {
+			return SCAN_YIELD;
+		}
+
+		if (!st->counting) scanAddPair(st, c, &it);
+		st->numkeys++;
+		more = snapshotNext(&it);
+	}
+	return SCAN_DONE;
+}
+
+/* Whether the keys of the calling shard in [start, end] seen by the scan
+ * can be counted at once: the engine ranks and no write since the snapshot
+ * saved a version. */
+static int scanCountFast(scanState *st)
+{
+	ordered_index *versions = serverTL->versions;
+
+	return serverTL->idx->type->rank && (st->snap == NULL ||
+			versions == NULL || index_count(versions) == 0);
+}
+
+/* Add the array header once the keys are counted, and what is left. */
+static void addReplyScan(client *c, scanState *st)
+{
+	sds reply;
+
+	if (st->limit == -1) {
+		addReply(c, st->keys);
+		st->keys = NULL;
+		return;
+	}
+
+	reply = sdsnew("*2\r\n");
+	if (st->cursor) {
+		reply = catBulk(reply, st->cursor, sdslen(st->cursor));
+	} else {
+		reply = sdscat(reply, "$-1\r\n");
+	}
+	reply = sdscatfmt(reply, "*%U\r\n",
+			(unsigned long long)st->numkeys * (st->withvalues ? 2 : 1));
+	reply = sdscatsds(reply, st->keys);
+	sdsfree(st->keys);
+	st->keys = NULL;
+	addReply(c, reply);
+}
+
+/* The shards overlapping the range add their keys in turn, the range
+ * being split in key order. The page may end in a shard before the one
+ * holding its cursor. Every SCAN_SLICE_KEYS keys the job yields, so the
+ * other clients are served.
+ *
+ * RESP needs the length of an array before its elements, so without LIMIT
+ * the job first counts the keys, then rewinds and streams them: the shard
+ * of the client adds them to its reply as it goes, pausing while too much
+ * of it is unsent, and the other shards deliver theirs to it in parts. */
+static void scanShardProc(shardJob *job)
+{
+	scanState *st = job->privdata;
+	client *c = job->c;
+	sds start = st->start, end = st->end, key, resume = NULL;
+	int origin = serverTL->id == job->origin;
+	int stream = origin && st->limit == -1 && !st->counting;
+
+	/* nobody is left to read the reply */
+	if (origin && (c->flags & CLIENT_CLOSE_ASAP)) {
+		job->finished = 1;
+		return;
+	}
+	if (st->snap && snapshotExpired(st->snap)) {
+		st->expired = 1;
+		job->finished = 1;
 		return;
 	}
 
-	unsigned long numkeys = 0;
-	sl_node *node = server.sl->head->next[0];
-	sds tmp = sdsempty();
-	while (node) {
-		if (slKeyCompare(node->key, start) >= 0 && 
-			slKeyCompare(node->key, end) <= 0) {
+	/* a delivery, or the keys of the shards visited before, come first */
+	if (stream) {
+		if (c->reply_bytes > SCAN_REPLY_PENDING_MAX) {
+			job->yield = SHARD_YIELD_IDLE;
+			return;
+		}
+		if (sdslen(st->keys)) {
+			addReplyString(c, st->keys, sdslen(st->keys));
+			sdsclear(st->keys);
+		}
+		if (job->deliver) return;
+	}
 
-			tmp = sdscatfmt(tmp, "%S\n", node->key);
-			numkeys++;
+	if (st->resume) {
+		if (st->reverse) {
+			end = st->resume;
+		} else {
+			start = st->resume;
 		}
+	}
 
-		node = node->next[0];
+	if (st->counting && st->resume == NULL && scanCountFast(st)) {
+		st->numkeys += index_count_range(serverTL->idx, start, end);
+	} else switch (scanShard(st, stream ? c : NULL, start, end, &key)) {
+	case SCAN_FULL:
+		st->cursor = sdsdup(key);
+		job->finished = 1;
+		break;
+	case SCAN_YIELD:
+		resume = sdsdup(key);
+		if (stream && c->reply_bytes > SCAN_REPLY_PENDING_MAX) {
+			job->yield = SHARD_YIELD_IDLE;
+		} else if (!origin && st->limit == -1 &&
+				sdslen(st->keys) > SCAN_REPLY_PENDING_MAX) {
+			job->deliver = 1;
+		} else {
+			job->yield = SHARD_YIELD_NOW;
+		}
+		/* writes run before the next slice */
+		if (st->snap == NULL) st->snap = snapshotOpen();
+		break;
+	}
+	sdsfree(st->resume);
+	st->resume = resume;
+
+	/* all counted, now the keys */
+	if (st->counting && resume == NULL && job->shard == job->last) {
+		st->keys = sdscatfmt(st->keys, "*%U\r\n",
+				(unsigned long long)st->numkeys * (st->withvalues ? 2 : 1));
+		st->counting = 0;
+		st->numkeys = 0;
+		job->rewind = 1;
 	}
+}
 
-	addReplyString(c, "+", 1);
-	/* drop the last '\n' */
-	sdsrange(tmp, 0, -2);
-	addReply(c, tmp);
-	addReply(c, sdsnew("\r\n"));
-	return;
+static void scanShardDone(shardJob *job)
+{
+	scanState *st = job->privdata;
+
+	/* the reply is cut short, only closing the client can tell */
+	if (st->expired) {
+		server_log(LL_WARNING, "Closing client whose scan outlived snapshot-max-age");
+		freeClient(job->c);
+	} else if (!st->counting) {
+		/* the client may have closed before the keys were counted */
+		addReplyScan(job->c, st);
+	}
+	sdsfree(st->keys);
+	if (st->snap) snapshotClose(st->snap);
+	sdsfree(st->start);
+	sdsfree(st->end);
+	sdsfree(st->cursor);
+	sdsfree(st->resume);
+	zfree(st);
+}
+
+/* scan and rscan: keys in [start, end], in ascending or descending order,
+ * as an array. With WITHVALUES each key is followed by its value.
+ *
+ * With LIMIT n at most n keys are returned as a two elements array: the key
+ * to resume from, nil once the range is exhausted, and the keys. A page
+ * holding SCAN_REPLY_PENDING_MAX bytes ends before n keys. The next page
+ * is "scan <cursor> end LIMIT n", or "rscan start <cursor> LIMIT n".
+ *
+ * The scan runs as a job, see scanShardProc(). */
+static void scanGenericCommand(client *c, int reverse)
+{
+	sds start = c->argv[1];
+	sds end = c->argv[2];
+	long long limit = -1;
+	int withvalues = 0, j;
+	scanState *st;
+	shardJob *job;
+
+	for (j = 3; j < c->argc; j++) {
+		if (!strcasecmp(c->argv[j], "withvalues")) {
+			withvalues = 1;
+		} else if (!strcasecmp(c->argv[j], "limit") && j + 1 < c->argc) {
+			j++;
+			if (!string2ll(c->argv[j], sdslen(c->argv[j]), &limit) || limit <= 0) {
+				addReplyErrorFormat(c, "LIMIT should be a positive integer");
+				return;
+			}
+		} else {
+			addReplyErrorFormat(c, "syntax error");
+			return;
+		}
+	}
+
+	if (!checkRange(c, start, end)) {
+		return;
+	}
+
+	st = zmalloc(sizeof(*st));
+	st->start = sdsdup(start);
+	st->end = sdsdup(end);
+	st->reverse = reverse;
+	st->withvalues = withvalues;
+	st->counting = limit == -1;
+	st->expired = 0;
+	st->limit = limit;
+	st->numkeys = 0;
+	st->keys = sdsempty();
+	st->cursor = NULL;
+	st->resume = NULL;
+	/* the shards are visited one after the other while they go on writing,
+	 * a scan of a single shard takes its snapshot when it first yields */
+	st->snap = server.shard_num > 1 ? snapshotOpen() : NULL;
+
+	job = reverse ?
+		shardCreateJob(c, shardOfKey(end), shardOfKey(start), scanShardProc, scanShardDone) :
+		shardCreateJob(c, shardOfKey(start), shardOfKey(end), scanShardProc, scanShardDone);
+	job->privdata = st;
+	shardRunJob(job);
+}
+
+static void scanCommand(client *c)
+{
+	scanGenericCommand(c, 0);
+}
+
+static void rscanCommand(client *c)
+{
+	scanGenericCommand(c, 1);
+}
+
+static void countShardProc(shardJob *job)
+{
+	job->count += index_count_range(serverTL->idx, job->c->argv[1], job->c->argv[2]);
+}
+
+/* count start end: number of keys in [start, end] */
+static void countCommand(client *c)
+{
+	if (!checkRange(c, c->argv[1], c->argv[2])) {
+		return;
+	}
+	if (server.shard_num > 1) {
+		shardRunJob(shardCreateJob(c, shardOfKey(c->argv[1]), shardOfKey(c->argv[2]),
+					countShardProc, addReplyCount));
+		return;
+	}
+
+	unsigned long count = index_count_range(serverTL->idx, c->argv[1], c->argv[2]);
+
+	addReply(c, sdscatfmt(sdsempty(), ":%U\r\n", (unsigned long long)count));
+}
+
+/* The job starts at the shard owning the key, then adds the keys of the
+ * shards before it. */
+static void rankShardProc(shardJob *job)
+{
+	sds key = job->c->argv[1];
+
+	if (serverTL->id != shardOfKey(key)) {
+		job->count += index_count(serverTL->idx);
+	} else if (lookupKey(key) == NULL) {
+		job->reply = sdsnew("$-1\r\n");
+		job->finished = 1;
+	} else {
+		job->count += index_rank(serverTL->idx, key);
+	}
+}
+
+static void rankShardDone(shardJob *job)
+{
+	if (job->reply) {
+		addReplyString(job->c, job->reply, sdslen(job->reply));
+	} else {
+		addReplyCount(job);
+	}
+}
+
+/* rank key: 0 based position of key in key order, nil if it does not exist */
+static void rankCommand(client *c)
+{
+	if (server.shard_num > 1) {
+		shardRunJob(shardCreateJob(c, shardOfKey(c->argv[1]), 0,
+					rankShardProc, rankShardDone));
+		return;
+	}
+
+	if (lookupKey(c->argv[1]) == NULL) {
+		addReply(c, sdsnew("$-1\r\n"));
+		return;
+	}
+
+	addReply(c, sdscatfmt(sdsempty(), ":%U\r\n",
+				(unsigned long long)index_rank(serverTL->idx, c->argv[1])));
+}
+
+typedef struct infoState {
+	sds min, max;   /* of the first and the last shard with keys */
+	sds fields;     /* engine fields of every shard */
+} infoState;
+
+static void infoShardProc(shardJob *job)
+{
+	infoState *st = job->privdata;
+	unsigned long count = index_count(serverTL->idx);
+	sds fields = index_info(serverTL->idx, sdsempty());
+	sds *f;
+	int n, j;
+
+	/* ",name=value" becomes ",shard<id>_name=value" */
+	f = sdssplitlen(fields, sdslen(fields), ",", 1, &n);
+	for (j = 0; j < n; j++) {
+		if (sdslen(f[j]) == 0) continue;
+		st->fields = sdscatfmt(st->fields, ",shard%i_%S", serverTL->id, f[j]);
+	}
+	sdsfreesplitres(f, n);
+	sdsfree(fields);
+
+	if (count == 0) return;
+	job->count += count;
+	if (st->min == NULL) st->min = sdsdup(ENTRY_KEY(index_min(serverTL->idx)));
+	sdsfree(st->max);
+	st->max = sdsdup(ENTRY_KEY(index_max(serverTL->idx)));
+}
+
+static void infoShardDone(shardJob *job)
+{
+	infoState *st = job->privdata;
+	sds info;
+
+	if (st->min == NULL) {
+		st->min = sdsnew("NULL");
+		st->max = sdsnew("NULL");
+	}
+	info = sdscatfmt(sdsempty(),
+		"tadpole:keys=%U,min=%S,max=%S,shards=%i%S",
+		(unsigned long long)job->count, st->min, st->max, server.shard_num,
+		st->fields);
+	addReplyString(job->c, "+", 1);
+	addReply(job->c, info);
+	addReply(job->c, sdsnew("\r\n"));
+	sdsfree(st->min);
+	sdsfree(st->max);
+	sdsfree(st->fields);
+	zfree(st);
 }
 
 /* 
@@ -233,11 +875,26 @@ static void infoCommand(client *c)
 {
 	sds info;
 
-	info = sdscatfmt(sdsempty(), 
-	    "tadpole:keys=%i,min=%S,max=%S", 
-		server.sl->length,
-		server.sl->length == 0 ? sdsnew("NULL"):server.sl->head->next[0]->key,
-		server.sl->length == 0 ? sdsnew("NULL"):find_max_skiplist(server.sl));
+	if (server.shard_num > 1) {
+		shardJob *job = shardCreateJob(c, 0, server.shard_num - 1,
+						infoShardProc, infoShardDone);
+		job->privdata = zcalloc(sizeof(infoState));
+		((infoState *)job->privdata)->fields = sdsempty();
+		shardRunJob(job);
+		return;
+	}
+
+	unsigned long count = index_count(serverTL->idx);
+	info = sdscatfmt(sdsempty(), "tadpole:keys=%U", (unsigned long long)count);
+	if (count == 0) {
+		info = sdscat(info, ",min=NULL,max=NULL");
+	} else {
+		info = sdscatfmt(info, ",min=%S,max=%S",
+			ENTRY_KEY(index_min(serverTL->idx)),
+			ENTRY_KEY(index_max(serverTL->idx)));
+	}
+	/* engine specific fields, e.g. slab usage in fixed-length mode */
+	info = index_info(serverTL->idx, info);
 
 	addReplyString(c, "+", 1);
 	addReply(c, info);
@@ -249,6 +906,11 @@ static void infoCommand(client *c)
 
 static void shutdownCommand(client *c)
 {
+	/* the main thread joins the other shards before exiting */
+	if (serverTL->id != 0) {
+		shutdownShards();
+		return;
+	}
 	server_log(LL_WARNING, "tadpole is now ready to exit, bye bye...");
 	/* exit immediately */
 	exit(0);
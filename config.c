@@ -1,10 +1,13 @@
 #include "db.h"
 #include "sds.h"
+#include "util.h"
+#include "iothreads.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
@@ -93,6 +96,86 @@ void loadServerConfigFromString(char *config)
 			server.fl = (struct fixed_length *)malloc(sizeof(struct fixed_length));
 			server.fl->key_len = atoi(argv[1]);
 			server.fl->val_len = atoi(argv[2]);
+		} else if (!strcasecmp(argv[0],"client-query-buffer-limit") && argc == 2) {
+			int memerr;
+			long long limit = memtoll(argv[1], &memerr);
+			if (memerr || limit < 1024*1024 || limit > PROTO_MAX_QUERYBUF_LEN) {
+				err = "client-query-buffer-limit must be between 1mb and 1gb";
+				goto loaderr;
+			}
+			server.client_max_querybuf_len = limit;
+		} else if (!strcasecmp(argv[0],"maxclients") && argc == 2) {
+			server.maxclients = atoi(argv[1]);
+			if (server.maxclients < 1) {
+				err = "Invalid max clients limit"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"tcp-backlog") && argc == 2) {
+			server.tcp_backlog = atoi(argv[1]);
+			if (server.tcp_backlog < 0) {
+				err = "Invalid backlog value"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"tcp-listeners") && argc == 2) {
+			server.tcp_listeners = atoi(argv[1]);
+			if (server.tcp_listeners < 1 ||
+				server.tcp_listeners > CONFIG_MAX_LISTENERS)
+			{
+				err = "Invalid number of listeners, must be between 1 and 16";
+				goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"unixsocket") && argc == 2) {
+			struct sockaddr_un sa;
+			if (strlen(argv[1]) >= sizeof(sa.sun_path)) {
+				err = "Unix socket path too long"; goto loaderr;
+			}
+			zfree(server.unixsocket);
+			server.unixsocket = zstrdup(argv[1]);
+		} else if (!strcasecmp(argv[0],"unixsocketperm") && argc == 2) {
+			errno = 0;
+			server.unixsocketperm = (mode_t)strtol(argv[1], NULL, 8);
+			if (errno || server.unixsocketperm > 0777) {
+				err = "Invalid socket file permissions"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"io-threads") && argc == 2) {
+			server.io_threads_num = atoi(argv[1]);
+			if (server.io_threads_num < 1 || server.io_threads_num > IO_THREADS_MAX_NUM) {
+				err = "Invalid number of io threads, must be between 1 and 128";
+				goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"shards") && argc == 2) {
+			server.shard_num = atoi(argv[1]);
+			if (server.shard_num < 1 || server.shard_num > CONFIG_MAX_SHARDS) {
+				err = "Invalid number of shards, must be between 1 and 64";
+				goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"shard-bounds") && argc >= 2) {
+			int j;
+
+			for (j = 2; j < argc; j++) {
+				if (index_key_compare(argv[j-1], argv[j]) >= 0) {
+					err = "shard-bounds keys must be in ascending order";
+					goto loaderr;
+				}
+			}
+			server.shard_bounds = zmalloc(sizeof(sds) * (argc-1));
+			server.shard_bounds_num = argc-1;
+			for (j = 1; j < argc; j++) {
+				server.shard_bounds[j-1] = sdsdup(argv[j]);
+			}
+		} else if (!strcasecmp(argv[0],"snapshot-max-age") && argc == 2) {
+			server.snapshot_max_age = atoi(argv[1]);
+			if (server.snapshot_max_age < 0) {
+				err = "Invalid snapshot max age"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"io-uring") && argc == 2) {
+			if ((server.io_uring = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0],"index-engine") && argc == 2) {
+			server.index_engine = index_type_lookup(argv[1]);
+			if (server.index_engine == NULL) {
+				err = "Invalid index engine. Must be one of skiplist, cskiplist, btree, art";
+				goto loaderr;
+			}
         } else if (!strcasecmp(argv[0],"dbfilename") && argc == 2) {
             if (!pathIsBaseName(argv[1])) {
                 err = "dbfilename can't be a path, just a filename";
@@ -107,6 +190,28 @@ void loadServerConfigFromString(char *config)
 	}
 
 	sdsfreesplitres(lines,totlines);
+
+	/* Sanity checks of the directives together. */
+	if (server.shard_bounds_num && server.shard_bounds_num != server.shard_num - 1) {
+		fprintf(stderr, "\n*** FATAL CONFIG FILE ERROR ***\n");
+		fprintf(stderr, "shard-bounds must give %d keys for %d shards\n",
+				server.shard_num - 1, server.shard_num);
+		exit(1);
+	}
+	if (server.shard_num > 1 && server.io_threads_num > 1) {
+		fprintf(stderr, "\n*** FATAL CONFIG FILE ERROR ***\n");
+		fprintf(stderr, "io-threads can not be used with shards\n");
+		exit(1);
+	}
+	/* without bounds, split on the first byte of the keys */
+	if (server.shard_bounds_num == 0 && server.shard_num > 1) {
+		server.shard_bounds = zmalloc(sizeof(sds) * (server.shard_num-1));
+		server.shard_bounds_num = server.shard_num-1;
+		for (i = 1; i < server.shard_num; i++) {
+			char first = (char)(i * 256 / server.shard_num);
+			server.shard_bounds[i-1] = sdsnewlen(&first, 1);
+		}
+	}
 	return;
 
 loaderr:
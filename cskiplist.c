@@ -0,0 +1,496 @@
+#include "cskiplist.h"
+#include "epoch.h"
+#include "sds.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+
+#define MAX_LEVEL CSKIPLIST_MAX_LEVEL
+
+#define MARKED(p) ((uintptr_t)(p) & 1)
+#define MARK(p) ((csl_node *)((uintptr_t)(p) | 1))
+#define UNMARK(p) ((csl_node *)((uintptr_t)(p) & ~(uintptr_t)1))
+
+static inline csl_node *load_next(csl_node *n, int i)
+{
+	return __atomic_load_n(&n->next[i], __ATOMIC_ACQUIRE);
+}
+
+static inline int cas_next(csl_node *n, int i, csl_node *old, csl_node *new)
+{
+	return __atomic_compare_exchange_n(&n->next[i], &old, new, 0,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* bytes of a node in front of its key */
+static size_t cskiplist_node_hdr(int level)
+{
+	return sizeof(csl_node) + level * sizeof(csl_node *);
+}
+
+static csl_node *create_cskiplist_node(int level, const char *key, size_t klen,
+		const char *val, size_t vlen)
+{
+	size_t hdr = cskiplist_node_hdr(level);
+	size_t prefix = index_entry_prefix(hdr, klen);
+	csl_node *node = (csl_node *)malloc(prefix + vlen);
+
+	if (!node) {
+		return NULL;
+	}
+	node->level = level;
+	memset(node->next, 0, level * sizeof(csl_node *));
+	index_entry_init(&node->entry, hdr, key, klen, val, vlen,
+			malloc_usable_size(node) - prefix);
+	return node;
+}
+
+static void free_cskiplist_node(void *ptr)
+{
+	csl_node *node = ptr;
+
+	index_entry_free_val(&node->entry);
+	free(node);
+}
+
+cskiplist *create_cskiplist(void)
+{
+	cskiplist *sl = (cskiplist *)malloc(sizeof(cskiplist));
+	if (!sl) {
+		return NULL;
+	}
+
+	sl->level = 1;
+	sl->length = 0;
+	sl->head = create_cskiplist_node(MAX_LEVEL, NULL, 0, NULL, 0);
+	if (!sl->head) {
+		free(sl);
+		return NULL;
+	}
+	return sl;
+}
+
+/* No other thread may use sl any more. Nodes already retired are freed by
+ * the epochs. */
+void release_cskiplist(cskiplist *sl)
+{
+	csl_node *node = UNMARK(sl->head->next[0]), *next;
+
+	while (node) {
+		next = UNMARK(node->next[0]);
+		free_cskiplist_node(node);
+		node = next;
+	}
+	free(sl->head);
+	free(sl);
+}
+
+/* The random state is per thread, rand() is not meant for concurrent use. */
+static __thread uint32_t level_seed;
+
+static int gen_random_level(void)
+{
+	uint32_t x = level_seed;
+	int level;
+
+	if (x == 0) {
+		x = (uint32_t)(uintptr_t)&level_seed | 1;
+	}
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	level_seed = x;
+
+	/* one more level for each trailing one bit, p = 1/2 */
+	level = 1 + __builtin_ctz(~x);
+	return (level > MAX_LEVEL) ? MAX_LEVEL : level;
+}
+
+/* Fill preds and succs with the nodes around key at each level, unlinking
+ * the marked nodes met on the way. With a target, nodes equal to key are
+ * passed until target, which is how a replaced node is reached behind its
+ * replacement. Return succs[0]. */
+static csl_node *csl_find(cskiplist *sl, sds key, csl_node *target,
+		csl_node **preds, csl_node **succs)
+{
+	int top = __atomic_load_n(&sl->level, __ATOMIC_ACQUIRE);
+	csl_node *pred, *curr, *succ;
+	int i, cmp;
+
+	for (i = MAX_LEVEL - 1; i >= top; i--) {
+		preds[i] = sl->head;
+		succs[i] = NULL;
+	}
+
+retry:
+	pred = sl->head;
+	for (i = top - 1; i >= 0; i--) {
+		curr = UNMARK(load_next(pred, i));
+		while (curr) {
+			succ = load_next(curr, i);
+			if (MARKED(succ)) {
+				/* fails when pred itself got marked, start over */
+				if (!cas_next(pred, i, curr, UNMARK(succ))) {
+					goto retry;
+				}
+				curr = UNMARK(succ);
+				continue;
+			}
+			cmp = index_key_compare(CSL_NODE_KEY(curr), key);
+			if (cmp < 0 || (cmp == 0 && target && curr != target)) {
+				pred = curr;
+				curr = succ;
+				continue;
+			}
+			break;
+		}
+		preds[i] = pred;
+		succs[i] = curr;
+	}
+	return succs[0];
+}
+
+/* Like csl_find() without writes and without the arrays: return the first
+ * live node >= key, and in *predp the last live node < key. */
+static csl_node *csl_seek(cskiplist *sl, sds key, csl_node **predp)
+{
+	int top = __atomic_load_n(&sl->level, __ATOMIC_ACQUIRE);
+	csl_node *pred = sl->head, *curr = NULL, *succ;
+	int i;
+
+	for (i = top - 1; i >= 0; i--) {
+		curr = UNMARK(load_next(pred, i));
+		while (curr) {
+			succ = load_next(curr, i);
+			if (MARKED(succ)) {
+				curr = UNMARK(succ);
+			} else if (index_key_compare(CSL_NODE_KEY(curr), key) < 0) {
+				pred = curr;
+				curr = succ;
+			} else {
+				break;
+			}
+		}
+	}
+	if (predp) {
+		*predp = pred;
+	}
+	return curr;
+}
+
+/* Raise the level in use to at least level. */
+static void csl_raise_level(cskiplist *sl, int level)
+{
+	int top = __atomic_load_n(&sl->level, __ATOMIC_RELAXED);
+
+	while (top < level && !__atomic_compare_exchange_n(&sl->level, &top, level, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Link node, already linked at level 0 behind preds, at its upper levels.
+ * Stop as soon as the node is found deleted. */
+static void csl_link_upper(cskiplist *sl, csl_node *node,
+		csl_node **preds, csl_node **succs)
+{
+	sds key = CSL_NODE_KEY(node);
+	csl_node *old;
+	int i;
+
+	for (i = 1; i < node->level; i++) {
+		for (;;) {
+			old = load_next(node, i);
+			if (MARKED(old)) {
+				return;
+			}
+			if (old != succs[i] && !cas_next(node, i, old, succs[i])) {
+				return;
+			}
+			if (cas_next(preds[i], i, succs[i], node)) {
+				break;
+			}
+			if (csl_find(sl, key, node, preds, succs) != node) {
+				return;
+			}
+		}
+		/* marked while being linked here: the deleter may already have
+		 * searched this level, unlink it before it can be freed */
+		if (MARKED(load_next(node, i))) {
+			csl_find(sl, key, node, preds, succs);
+			return;
+		}
+	}
+}
+
+/* Mark node top down, the level 0 mark deletes it, then unlink and retire
+ * it. Return -1 if another thread deleted it first. */
+static int csl_remove(cskiplist *sl, csl_node *node)
+{
+	csl_node *preds[MAX_LEVEL], *succs[MAX_LEVEL], *succ;
+	int i;
+
+	for (i = node->level - 1; i >= 1; i--) {
+		do {
+			succ = load_next(node, i);
+		} while (!MARKED(succ) && !cas_next(node, i, succ, MARK(succ)));
+	}
+	for (;;) {
+		succ = load_next(node, 0);
+		if (MARKED(succ)) {
+			return -1;
+		}
+		if (cas_next(node, 0, succ, MARK(succ))) {
+			break;
+		}
+	}
+
+	csl_find(sl, CSL_NODE_KEY(node), node, preds, succs);
+	__atomic_sub_fetch(&sl->length, 1, __ATOMIC_RELAXED);
+	epoch_retire(node, free_cskiplist_node);
+	return 0;
+}
+
+/* Link a new node for key/val in front of the first node >= key, which is
+ * where a replaced node stays until it is deleted. */
+static csl_node *csl_link(cskiplist *sl, int level, sds key,
+		const char *val, size_t vlen)
+{
+	csl_node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+	csl_node *node;
+	int i;
+
+	node = create_cskiplist_node(level, key, sdslen(key), val, vlen);
+	if (!node) {
+		return NULL;
+	}
+	csl_raise_level(sl, level);
+	do {
+		csl_find(sl, key, NULL, preds, succs);
+		for (i = 0; i < level; i++) {
+			node->next[i] = succs[i];
+		}
+	} while (!cas_next(preds[0], 0, succs[0], node));
+
+	csl_link_upper(sl, node, preds, succs);
+	__atomic_add_fetch(&sl->length, 1, __ATOMIC_RELAXED);
+	return node;
+}
+
+/* Insert key/val and return the node holding them. If the key is already
+ * present its node is replaced as update_cskiplist() does. NULL is returned
+ * on out of memory. */
+csl_node *insert_cskiplist(cskiplist *sl, sds key, const char *val, size_t vlen)
+{
+	csl_node *node;
+
+	epoch_enter();
+	node = csl_seek(sl, key, NULL);
+	if (node && index_key_compare(CSL_NODE_KEY(node), key) == 0) {
+		node = update_cskiplist(sl, node, val, vlen);
+	} else {
+		node = csl_link(sl, gen_random_level(), key, val, vlen);
+	}
+	epoch_exit();
+	return node;
+}
+
+/* Replace node with a new node holding val, and return it. Concurrent
+ * readers keep a valid view of the old node, which is freed once they are
+ * done. On out of memory NULL is returned and node stays. */
+csl_node *update_cskiplist(cskiplist *sl, csl_node *node, const char *val, size_t vlen)
+{
+	csl_node *q;
+
+	epoch_enter();
+	q = csl_link(sl, node->level, CSL_NODE_KEY(node), val, vlen);
+	if (q) {
+		csl_remove(sl, node);
+	}
+	epoch_exit();
+	return q;
+}
+
+int delete_cskiplist(cskiplist *sl, sds key)
+{
+	csl_node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+	csl_node *node;
+	int ret = -1;
+
+	epoch_enter();
+	/* retry if another thread deleted it in between */
+	while ((node = csl_find(sl, key, NULL, preds, succs)) &&
+			index_key_compare(CSL_NODE_KEY(node), key) == 0) {
+		if (csl_remove(sl, node) == 0) {
+			ret = 0;
+			break;
+		}
+	}
+	epoch_exit();
+	return ret;
+}
+
+/* Readers of other threads call it in a section, see cskiplist.h. */
+csl_node *search_cskiplist(cskiplist *sl, sds key)
+{
+	csl_node *node = csl_seek(sl, key, NULL);
+
+	if (node && index_key_compare(CSL_NODE_KEY(node), key) != 0) {
+		node = NULL;
+	}
+	return node;
+}
+
+/* Return the first live node after node in key order. A node being
+ * replaced is right behind its replacement, so equal keys are skipped. */
+static csl_node *csl_next_live(csl_node *node)
+{
+	sds key = CSL_NODE_KEY(node);
+	csl_node *q = UNMARK(load_next(node, 0));
+
+	while (q && (MARKED(load_next(q, 0)) ||
+				index_key_compare(CSL_NODE_KEY(q), key) == 0)) {
+		q = UNMARK(load_next(q, 0));
+	}
+	return q;
+}
+
+/*-----------------------------------------------------------------------------
+ * Ordered index engine
+ *----------------------------------------------------------------------------*/
+static void *csl_create(void)
+{
+	return create_cskiplist();
+}
+
+static void csl_release(void *ptr)
+{
+	release_cskiplist(ptr);
+}
+
+static index_entry *csl_insert(void *ptr, sds key, const char *val, size_t vlen)
+{
+	return (index_entry *)insert_cskiplist(ptr, key, val, vlen);
+}
+
+static index_entry *csl_update(void *ptr, index_entry *e, const char *val, size_t vlen)
+{
+	return (index_entry *)update_cskiplist(ptr, (csl_node *)e, val, vlen);
+}
+
+static index_entry *csl_lookup(void *ptr, sds key)
+{
+	return (index_entry *)search_cskiplist(ptr, key);
+}
+
+static int csl_delete(void *ptr, sds key)
+{
+	return delete_cskiplist(ptr, key);
+}
+
+static unsigned long csl_count(void *ptr)
+{
+	return __atomic_load_n(&((cskiplist *)ptr)->length, __ATOMIC_RELAXED);
+}
+
+static index_entry *csl_first(void *ptr, index_iter *it)
+{
+	cskiplist *sl = ptr;
+	csl_node *q;
+
+	q = UNMARK(load_next(sl->head, 0));
+	while (q && MARKED(load_next(q, 0))) {
+		q = UNMARK(load_next(q, 0));
+	}
+	it->node = q;
+	return it->node;
+}
+
+static index_entry *csl_last(void *ptr, index_iter *it)
+{
+	cskiplist *sl = ptr;
+	int top = __atomic_load_n(&sl->level, __ATOMIC_ACQUIRE);
+	csl_node *pred = sl->head, *curr, *succ;
+	int i;
+
+	for (i = top - 1; i >= 0; i--) {
+		curr = UNMARK(load_next(pred, i));
+		while (curr) {
+			succ = load_next(curr, i);
+			if (!MARKED(succ)) {
+				pred = curr;
+			}
+			curr = UNMARK(succ);
+		}
+	}
+	it->node = (pred == sl->head) ? NULL : pred;
+	return it->node;
+}
+
+static index_entry *csl_seek_entry(void *ptr, index_iter *it, sds key)
+{
+	it->node = csl_seek(ptr, key, NULL);
+	return it->node;
+}
+
+static index_entry *csl_next(void *ptr, index_iter *it)
+{
+	(void)ptr;
+	if (it->node) {
+		it->node = csl_next_live(it->node);
+	}
+	return it->node;
+}
+
+/* There are no backward links, search for the last node < the current. */
+static index_entry *csl_prev(void *ptr, index_iter *it)
+{
+	cskiplist *sl = ptr;
+	csl_node *pred;
+
+	if (it->node) {
+		csl_seek(sl, CSL_NODE_KEY((csl_node *)it->node), &pred);
+		it->node = (pred == sl->head) ? NULL : pred;
+	}
+	return it->node;
+}
+
+static void csl_read_begin(void *ptr)
+{
+	(void)ptr;
+	epoch_enter();
+}
+
+static void csl_read_end(void *ptr)
+{
+	(void)ptr;
+	epoch_exit();
+}
+
+static sds csl_info(void *ptr, sds s)
+{
+	(void)ptr;
+	/* replaced and deleted nodes waiting for the readers */
+	return sdscatfmt(s, ",retired=%U", (unsigned long long)epoch_pending());
+}
+
+index_type cskiplistIndexType = {
+	"cskiplist",
+	csl_create,
+	csl_release,
+	NULL,
+	csl_insert,
+	csl_update,
+	csl_lookup,
+	csl_delete,
+	csl_count,
+	csl_first,
+	csl_last,
+	csl_seek_entry,
+	csl_next,
+	csl_prev,
+	csl_info,
+	NULL,
+	0,
+	csl_read_begin,
+	csl_read_end
+};
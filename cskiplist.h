@@ -0,0 +1,51 @@
+#ifndef __CSKIPLIST_H__
+#define __CSKIPLIST_H__
+#include "sds.h"
+#include "index.h"
+#include <stdint.h>
+
+/* Lock free skiplist. Nodes are linked with compare and swap, and a node is
+ * deleted by first marking its links (the low bit of each next pointer),
+ * which is the point where it leaves the set, then unlinking it. Searches
+ * unlink the marked nodes they meet. Readers never write, so lookups and
+ * iterations may run in other threads while a writer changes the list.
+ * Unlinked nodes are retired through epoch.c and freed once no reader can
+ * still hold them, so a reader in another thread holds an epoch_enter()/
+ * epoch_exit() section, index_read_begin()/index_read_end() through the
+ * index, around its calls and for as long as it uses the nodes returned.
+ * A writer frees only what it retired itself, so the list of a single
+ * writing thread is read without a section by that thread. With shards,
+ * the other shards serve get and mget this way, see shardReadsInPlace().
+ *
+ * The value of a linked node never changes. An update links a new node in
+ * front of the old one and then deletes the old one, so a reader sees
+ * either value whole.
+ *
+ * There are no backward links: each step of a reverse iteration searches
+ * from the head, O(log n) rather than O(1). */
+#define CSKIPLIST_MAX_LEVEL 16
+
+typedef struct cskiplist_node {
+	index_entry entry;  /* must be first, callers see nodes as entries */
+	uint8_t level;
+	struct cskiplist_node *next[];  /* level links, marked once deleted */
+} csl_node;
+
+#define CSL_NODE_KEY(n) ENTRY_KEY(&(n)->entry)
+
+typedef struct cskiplist {
+	csl_node *head;
+	int level;              /* highest level in use, only grows */
+	unsigned long length;
+} cskiplist;
+
+extern index_type cskiplistIndexType;
+
+cskiplist *create_cskiplist(void);
+void release_cskiplist(cskiplist *sl);
+csl_node *search_cskiplist(cskiplist *sl, sds key);
+csl_node *insert_cskiplist(cskiplist *sl, sds key, const char *val, size_t vlen);
+csl_node *update_cskiplist(cskiplist *sl, csl_node *node, const char *val, size_t vlen);
+int delete_cskiplist(cskiplist *sl, sds key);
+
+#endif
@@ -4,6 +4,10 @@
 #include "db.h"
 #include "log.h"
 #include "util.h"
+#include "iothreads.h"
+#include "shard.h"
+#include "snapshot.h"
+#include "skiplist.h"
 
 #include <string.h>
 #include <unistd.h>
@@ -12,25 +16,26 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 
-#define UNUSED(V) ((void) V)
 #define CONFIG_DEFAULT_SERVER_PORT   6666
 #define CONFIG_MAX_LINE              1024
-#define MAX_EVENT_SIZE               1024
 
 
 struct dbServer server;
+__thread dbShard *serverTL;     /* shard of the calling thread */
 
-/* Sorted sets hash (note: a skiplist is used in addition to the hash table) */
+/* Keys to index entries. The key is shared with the entry that owns it,
+ * so the dict must not free it: drop the dict entry before the index one. */
 dictType slDictType = {
     dictSdsHash,               /* hash function */
     NULL,                      /* key dup */
     NULL,                      /* val dup */
     dictSdsKeyCompare,         /* key compare */
-	dictSdsDestructor,		   /* key destructor */
+    NULL,                      /* key destructor */
     NULL                       /* val destructor */
 };
 
@@ -82,12 +87,29 @@ void process_para(int argc, char *argv[])
 /* initialize server configuration */
 void init_config()
 {
-	server.sock_fd = -1;
 	server.port = CONFIG_DEFAULT_SERVER_PORT;
+	server.tcp_backlog = CONFIG_DEFAULT_TCP_BACKLOG;
+	server.tcp_listeners = 1;
+	server.unixsocket = NULL;
+	server.unixsocketperm = CONFIG_DEFAULT_UNIX_SOCKET_PERM;
+	server.sofd = -1;
+	server.io_uring = 0;
+	server.io_threads_num = 1;
+	server.shards = NULL;
+	server.shard_num = 1;
+	server.shard_bounds = NULL;
+	server.shard_bounds_num = 0;
+	server.snapshot_max_age = CONFIG_DEFAULT_SNAPSHOT_MAX_AGE;
+	server.shutdown_asap = 0;
 	server.verbosity = CONFIG_DEFAULT_VERBOSITY;
 	server.config_file = NULL;
 	server.log_file = NULL;
 	server.commands = dictCreate(&commandTableDictType, NULL);
+	server.index_engine = &skiplistIndexType;
+	server.client_max_querybuf_len = PROTO_MAX_QUERYBUF_LEN;
+	server.maxclients = CONFIG_DEFAULT_MAX_CLIENTS;
+	server.connected_clients = 0;
+	server.unixtime = time(NULL);
 
 	return;
 }
@@ -155,6 +177,11 @@ static void sigShutdownHandler(int sig)
 		msg = "Received shutdown signal, scheduling shutdown...";
 	};
 
+	/* the main thread joins the shards before exiting */
+	if (server.shard_num > 1) {
+		shutdownShards();
+		return;
+	}
 	exit(0);
 
 }
@@ -190,19 +217,96 @@ static void setupSignalHandlers(void)
 	return;
 }
 
-#define MAX_BACKLOG_SIZE 128
-static int listenToPort(int port)
+/* Check that the kernel does not silently truncate the configured backlog
+ * to a lower somaxconn. */
+static void checkTcpBacklogSettings(void)
+{
+#if defined(__linux__)
+	FILE *fp = fopen("/proc/sys/net/core/somaxconn", "r");
+	char buf[1024];
+
+	if (!fp) return;
+	if (fgets(buf, sizeof(buf), fp) != NULL) {
+		int somaxconn = atoi(buf);
+		if (somaxconn > 0 && somaxconn < server.tcp_backlog) {
+			server_log(LL_WARNING, "WARNING: The TCP backlog setting of %d cannot be "
+					"enforced because /proc/sys/net/core/somaxconn is set to the lower "
+					"value of %d.", server.tcp_backlog, somaxconn);
+		}
+	}
+	fclose(fp);
+#endif
+}
+
+/* Open tcp-listeners sockets on port into fds. Several listeners share the
+ * port with SO_REUSEPORT and the kernel spreads new connections among
+ * them, so a reconnect storm does not queue on a single accept queue.
+ * Every shard opens its own. */
+static int listenToPort(int port, int *fds, int *count)
+{
+	int flags = server.tcp_listeners > 1 || server.shard_num > 1 ?
+		ANET_REUSEPORT : ANET_NONE;
+	int j;
+
+	for (j = 0; j < server.tcp_listeners; j++) {
+		fds[j] = anetTcpServerFlags(serverTL->neterr, port, NULL,
+						server.tcp_backlog, flags);
+		if (fds[j] == ANET_ERR) {
+			server_log(LL_WARNING, "Creating server TCP listening socket *:%d: %s",
+					port, serverTL->neterr);
+			while (j--) close(fds[j]);
+			return SERVER_ERR;
+		}
+		anetNonBlock(NULL, fds[j]);
+		anetCloexec(fds[j]);
+	}
+	*count = j;
+	return SERVER_OK;
+}
+
+/* Close the listening sockets at exit so a restart can bind at once. The
+ * event loop goes first: io_uring holds a socket until its poll is
+ * removed, and would otherwise release it only after the process. */
+static void closeListeningSockets(void)
 {
-	int fd = 0;
+	int i, j;
 
-	fd = anetTcpServer(server.neterr, port, NULL, MAX_BACKLOG_SIZE);
-	if (fd == ANET_ERR) {
-		fprintf(stderr, "Create socket server fail\n");
+	for (i = 0; i < server.shard_num; i++) {
+		dbShard *s = &server.shards[i];
+
+		if (s->el) {
+			aeDeleteEventLoop(s->el);
+			s->el = NULL;
+		}
+		for (j = 0; j < s->ipfd_count; j++) close(s->ipfd[j]);
+	}
+	if (server.sofd != -1) {
+		close(server.sofd);
+		unlink(server.unixsocket);
+	}
+}
+
+/* Listen on the unixsocket path, a stale socket file left by a previous
+ * run is removed first. */
+static int listenToUnixSocket(void)
+{
+	unlink(server.unixsocket);
+	server.sofd = anetUnixServer(serverTL->neterr, server.unixsocket,
+					server.unixsocketperm, server.tcp_backlog);
+	if (server.sofd == ANET_ERR) {
+		server_log(LL_WARNING, "Opening Unix socket: %s", serverTL->neterr);
+		server.sofd = -1;
 		return SERVER_ERR;
 	}
+	anetNonBlock(NULL, server.sofd);
+	anetCloexec(server.sofd);
+	return SERVER_OK;
+}
 
-	anetNonBlock(NULL, fd);
-	return fd;
+/* Run the command of c in the calling shard. */
+void call(client *c)
+{
+	c->cmd->proc(c);
 }
 
 /* If this function gets called we already read a whole
@@ -237,25 +341,91 @@ int processCommand(client *c) {
 		return SERVER_OK;
 	}
 
+	/* The shard owning the key runs the command, c waits for the reply.
+	 * A read may instead be done in place, see shardReadsInPlace(). */
+	if (server.shard_num > 1 && (c->cmd->flags & CMD_KEY) &&
+		((c->cmd->flags & CMD_WRITE) || !shardReadsInPlace()))
+	{
+		int shard = shardOfKey(c->argv[1]);
+		if (shard != serverTL->id) {
+			shardRunCommand(c, shard);
+			return SERVER_OK;
+		}
+	}
+
 	/* Exec the command */
-	c->cmd->proc(c);
+	call(c);
 
 	return SERVER_OK;
 }
 
+/* The shared read buffer of the calling thread, every I/O thread has its
+ * own, see initThreadQueryBuffer(). */
+static __thread sds *shared_qb = &server.shared_qb;
+
+void initThreadQueryBuffer(void)
+{
+	shared_qb = zmalloc(sizeof(sds));
+	*shared_qb = sdsMakeRoomFor(sdsempty(), PROTO_IOBUF_LEN);
+}
+
+/* Give back a query buffer holding no pending input. A partial command left
+ * in the shared buffer is copied to a buffer of the client's own. */
+static void releaseQueryBuffer(client *c)
+{
+	size_t pending = sdslen(c->querybuf) - c->qb_pos;
+
+	if (c->flags & CLIENT_SHARED_QUERYBUF) {
+		c->flags &= ~CLIENT_SHARED_QUERYBUF;
+		c->querybuf = pending ? sdsnewlen(c->querybuf + c->qb_pos, pending) : NULL;
+		c->qb_pos = 0;
+		sdsclear(*shared_qb);
+	} else if (pending == 0 && c->bulklen < PROTO_MBULK_BIG_ARG) {
+		/* a buffer sized for a big argument is kept, even empty */
+		sdsfree(c->querybuf);
+		c->querybuf = NULL;
+		c->qb_pos = 0;
+	}
+}
+
+/* Free the query buffer of c, the shared one is only emptied. */
+void freeQueryBuffer(client *c)
+{
+	if (c->flags & CLIENT_SHARED_QUERYBUF) {
+		c->flags &= ~CLIENT_SHARED_QUERYBUF;
+		sdsclear(*shared_qb);
+	} else {
+		sdsfree(c->querybuf);
+	}
+	c->querybuf = NULL;
+}
+
+/* Switch a client reading a big argument to a buffer of its own, the
+ * argument is going to be built in place. */
+static void detachSharedQueryBuffer(client *c)
+{
+	if (c->flags & CLIENT_SHARED_QUERYBUF) {
+		c->flags &= ~CLIENT_SHARED_QUERYBUF;
+		c->querybuf = sdsnewlen(c->querybuf + c->qb_pos, sdslen(c->querybuf) - c->qb_pos);
+		c->qb_pos = 0;
+		sdsclear(*shared_qb);
+	}
+}
+
 static int processInlineBuffer(client *c)
 {
-	char *newline;
-	int argc, j;
+	const char *start = c->querybuf + c->qb_pos, *newline;
+	size_t avail = sdslen(c->querybuf) - c->qb_pos;
+	int argc, j, linefeed_chars = 1;
 	sds *argv, aux;
 	size_t querylen;
 
 	/* Search for end of line */
-	newline = strchr(c->querybuf,'\n');
+	newline = findByte(start, avail, '\n');
 
 	/* Nothing to do without a \r\n */
 	if (newline == NULL) {
-		if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
+		if (avail > PROTO_INLINE_MAX_SIZE) {
 		// TODO
 #if 0
 			addReplyError(c,"Protocol error: too big inline request");
@@ -266,12 +436,14 @@ static int processInlineBuffer(client *c)
 	}
 
 	/* Handle the \r\n case. */
-	if (newline && newline != c->querybuf && *(newline-1) == '\r')
+	if (newline != start && *(newline-1) == '\r') {
 		newline--;
+		linefeed_chars++;
+	}
 
 	/* Split the input buffer up to the \r\n */
-	querylen = newline-(c->querybuf);
-	aux = sdsnewlen(c->querybuf,querylen);
+	querylen = newline - start;
+	aux = sdsnewlen(start,querylen);
 	argv = sdssplitargs(aux,&argc);
 	sdsfree(aux);
 	if (argv == NULL) {
@@ -284,9 +456,8 @@ static int processInlineBuffer(client *c)
 		return SERVER_ERR;
 	}
 
-
-	/* Leave data after the first line of the query in the buffer */
-	sdsrange(c->querybuf,querylen+2,-1);
+	/* Move past the line, the buffer is trimmed once per read */
+	c->qb_pos += querylen + linefeed_chars;
 
 	/* Setup argv array on client structure */
 	if (argc) {
@@ -294,58 +465,78 @@ static int processInlineBuffer(client *c)
 		c->argv = zmalloc(sizeof(sds)*argc);
 	}
 
-	/* Create redis objects for all arguments. */
+	/* The split strings become the arguments. */
 	for (c->argc = 0, j = 0; j < argc; j++) {
 		if (sdslen(argv[j])) {
-			c->argv[c->argc] = sdsdup(argv[j]);
+			c->argv[c->argc] = argv[j];
 			c->argc++;
 		} else {
 			sdsfree(argv[j]);
 		}
 	}
-	zfree(argv);
+	/* the vector comes from the sds allocator */
+	sds_free(argv);
 	return SERVER_OK;
 }
 
+/* Parse a "<type><length>\r\n" header line at p, where end is the end of
+ * the buffer. The digits are read as they are scanned, so the line needs no
+ * separate search for its CR. Return 1 with the length in *ll and the
+ * first byte after the line in *next, 0 if the line is not complete yet,
+ * or -1 on a protocol error. */
+static int parseLengthLine(const char *p, const char *end, char type,
+		long long *ll, const char **next)
+{
+	const char *s = p + 1, *digits;
+	unsigned long long v = 0;
+	int neg = 0;
+
+	if (p == end) return 0;
+	if (*p != type) return -1;
+	if (s < end && *s == '-') {
+		neg = 1;
+		s++;
+	}
+	digits = s;
+	while (s < end && *s >= '0' && *s <= '9') {
+		/* 18 digits cannot overflow */
+		if (s - digits == 18) return -1;
+		v = v * 10 + (*s - '0');
+		s++;
+	}
+	if (s == end) return 0;
+	if (s == digits || *s != '\r') return -1;
+	if (s + 1 == end) return 0;
+	if (s[1] != '\n') return -1;
+
+	*ll = neg ? -(long long)v : (long long)v;
+	*next = s + 2;
+	return 1;
+}
+
 int processMultibulkBuffer(client *c)
 {
-	char *newline = NULL;
-	int pos = 0, ok;
+	const char *p = c->querybuf + c->qb_pos;
+	const char *end = c->querybuf + sdslen(c->querybuf);
+	const char *next;
 	long long ll;
+	int ok;
 
 	if (c->multibulklen == 0) {
 		/* The client should have been reset */
 		assert(c->argc == 0);
 
 		/* Multi bulk length cannot be read without a \r\n */
-		newline = strchr(c->querybuf,'\r');
-		if (newline == NULL) {
-			if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
-			// TODO
-#if 0
-				addReplyError(c,"Protocol error: too big mbulk count string");
-				setProtocolError(c,0);
-#endif
-			}
-			return SERVER_ERR;
-		}
-
-		/* Buffer should also contain \n */
-		if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
-			return SERVER_ERR;
-
-		/* We know for sure there is a whole line since newline != NULL,
-		 * so go ahead and find out the multi bulk length. */
-		assert(c->querybuf[0] == '*');
-		ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
-		if (!ok || ll > 1024*1024) {
+		ok = parseLengthLine(p, end, '*', &ll, &next);
+		if (ok == 0) return SERVER_ERR;
+		if (ok < 0 || ll > 1024*1024) {
 			server_log(LL_WARNING, "Protocol error: invalid multibulk length");
 			return SERVER_ERR;
 		}
 
-		pos = (newline-c->querybuf)+2;
+		p = next;
 		if (ll <= 0) {
-			sdsrange(c->querybuf,pos,-1);
+			c->qb_pos = p - c->querybuf;
 			return SERVER_OK;
 		}
 
@@ -360,33 +551,14 @@ int processMultibulkBuffer(client *c)
 	while(c->multibulklen) {
 		/* Read bulk length if unknown */
 		if (c->bulklen == -1) {
-			newline = strchr(c->querybuf+pos,'\r');
-			if (newline == NULL) {
-				if (sdslen(c->querybuf) > PROTO_INLINE_MAX_SIZE) {
-					server_log(LL_WARNING, "Protocol error: too big bulk count string");
-					return SERVER_ERR;
-				}
-				break;
-			}
-
-			/* Buffer should also contain \n */
-			if (newline-(c->querybuf) > ((signed)sdslen(c->querybuf)-2))
-				break;
-
-			if (c->querybuf[pos] != '$') {
-				server_log(LL_WARNING, 
-						"Protocol error: Protocol error: expected '$', got '%c'",
-						c->querybuf[pos]);
-				return SERVER_ERR;
-			}
-
-			ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
-			if (!ok || ll < 0 || ll > 512*1024*1024) {
+			ok = parseLengthLine(p, end, '$', &ll, &next);
+			if (ok == 0) break;
+			if (ok < 0 || ll < 0 || ll > 512*1024*1024) {
 				server_log(LL_WARNING, "Protocol error: invalid bulk length");
 				return SERVER_ERR;
 			}
 
-			pos += newline-(c->querybuf+pos)+2;
+			p = next;
 			if (ll >= PROTO_MBULK_BIG_ARG) {
 				size_t qblen;
 
@@ -394,48 +566,53 @@ int processMultibulkBuffer(client *c)
 				 * try to make it likely that it will start at c->querybuf
 				 * boundary so that we can optimize object creation
 				 * avoiding a large copy of data. */
-				sdsrange(c->querybuf,pos,-1);
-				pos = 0;
+				c->qb_pos = p - c->querybuf;
+				if (c->flags & CLIENT_SHARED_QUERYBUF) {
+					detachSharedQueryBuffer(c);
+				} else {
+					sdsrange(c->querybuf,c->qb_pos,-1);
+					c->qb_pos = 0;
+				}
 				qblen = sdslen(c->querybuf);
 				/* Hint the sds library about the amount of bytes this string is
-				 * going to contain. */
+				 * going to contain. Not greedy: the buffer may become the
+				 * argument, and then the stored value. */
 				if (qblen < (size_t)ll+2)
-					c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+					c->querybuf = sdsMakeRoomForNonGreedy(c->querybuf,ll+2-qblen);
+				p = c->querybuf;
+				end = c->querybuf + qblen;
 			}
 			c->bulklen = ll;
 		}
 
 		/* Read bulk argument */
-		if (sdslen(c->querybuf)-pos < (unsigned)(c->bulklen+2)) {
+		if (end - p < c->bulklen + 2) {
 			/* Not enough data (+2 == trailing \r\n) */
 			break;
 		} else {
 			/* Optimization: if the buffer contains JUST our bulk element
 			 * instead of creating a new object by *copying* the sds we
 			 * just use the current sds string. */
-			if (pos == 0 &&
+			if (p == c->querybuf &&
 				c->bulklen >= PROTO_MBULK_BIG_ARG &&
 				(signed) sdslen(c->querybuf) == c->bulklen+2)
 			{
-				c->argv[c->argc++] = sdsdup(c->querybuf);
+				c->argv[c->argc++] = c->querybuf;
 				sdsIncrLen(c->querybuf,-2); /* remove CRLF */
-				/* Assume that if we saw a fat argument we'll see another one
-				 * likely... */
-				c->querybuf = sdsnewlen(NULL,c->bulklen+2);
-				sdsclear(c->querybuf);
-				pos = 0;
+				/* the next big argument gets a buffer sized for it */
+				c->querybuf = sdsempty();
+				p = end = c->querybuf;
 			} else {
-				c->argv[c->argc++] = sdsnewlen(c->querybuf+pos, c->bulklen);
-				//	createStringObject(c->querybuf+pos,c->bulklen);
-				pos += c->bulklen+2;
+				c->argv[c->argc++] = sdsnewlen(p, c->bulklen);
+				p += c->bulklen+2;
 			}
 			c->bulklen = -1;
 			c->multibulklen--;
 		}
 	}
 
-	/* Trim to pos */
-	if (pos) sdsrange(c->querybuf,pos,-1);
+	/* Move past what was consumed */
+	c->qb_pos = p - c->querybuf;
 
 	/* We're done when c->multibulk == 0 */
 	if (c->multibulklen == 0) return SERVER_OK;
@@ -459,48 +636,125 @@ void resetClient(client *c)
 	return;
 }
 
-static void processInputBuffer(client *c)
+/* Parse the next command of the query buffer into c->argv. Return
+ * SERVER_ERR if it is not complete yet. */
+static int parseCommand(client *c)
 {
-	/* Keep processing while there is something in the input buffer */
-	while(sdslen(c->querybuf)) {
-		/* Determine request type when unknown. */
-		if (!c->reqtype) {
-			if (c->querybuf[0] == '*') {
-				c->reqtype = PROTO_REQ_MULTIBULK;
-			} else {
-				c->reqtype = PROTO_REQ_INLINE;
-			}
-		}
-
-		if (c->reqtype == PROTO_REQ_INLINE) {
-			if (processInlineBuffer(c) != SERVER_OK) break;
-		} else if (c->reqtype == PROTO_REQ_MULTIBULK) {
-			if (processMultibulkBuffer(c) != SERVER_OK) break;
+	/* Determine request type when unknown. */
+	if (!c->reqtype) {
+		if (c->querybuf[c->qb_pos] == '*') {
+			c->reqtype = PROTO_REQ_MULTIBULK;
 		} else {
-			server_panic("Unknown request type");
+			c->reqtype = PROTO_REQ_INLINE;
 		}
+	}
+
+	if (c->reqtype == PROTO_REQ_INLINE) {
+		return processInlineBuffer(c);
+	} else if (c->reqtype == PROTO_REQ_MULTIBULK) {
+		return processMultibulkBuffer(c);
+	} else {
+		server_panic("Unknown request type");
+	}
+	return SERVER_ERR;
+}
+
+/* Run every complete command in the query buffer. Parsing only advances
+ * c->qb_pos, the consumed part is cut off once for the whole batch. */
+static void processInputBuffer(client *c)
+{
+	/* Keep processing while there is something in the input buffer, and
+	 * no command is running on other shards. */
+	while(c->qb_pos < sdslen(c->querybuf) && !(c->flags & CLIENT_SHARD_WAIT)) {
+		if (parseCommand(c) != SERVER_OK) break;
 
 		/* Multibulk processing could see a <= 0 length. */
 		if (c->argc == 0) {
 			resetClient(c);
 		} else {
-			/* Only reset the client when the command was executed. */
-			if (processCommand(c) == SERVER_OK) {
+			/* Only reset the client when the command was executed, the
+			 * argv of a waiting one is still read by other shards. */
+			if (processCommand(c) == SERVER_OK &&
+				!(c->flags & CLIENT_SHARD_WAIT)) {
 				resetClient(c);
 			}
 		}
 	}
+
+	if (c->qb_pos) {
+		sdsrange(c->querybuf,c->qb_pos,-1);
+		c->qb_pos = 0;
+	}
 	return;
 }
 
+/* Like processInputBuffer() but for an I/O thread: the complete commands
+ * are queued in c->cmdq for the main thread to run. */
+static void parseInputBuffer(client *c)
+{
+	while(c->qb_pos < sdslen(c->querybuf)) {
+		if (parseCommand(c) != SERVER_OK) break;
+
+		if (c->argc) {
+			if (c->cmdq_len == c->cmdq_cap) {
+				c->cmdq_cap = c->cmdq_cap ? c->cmdq_cap*2 : 16;
+				c->cmdq = zrealloc(c->cmdq, sizeof(parsedCommand)*c->cmdq_cap);
+			}
+			c->cmdq[c->cmdq_len].argc = c->argc;
+			c->cmdq[c->cmdq_len].argv = c->argv;
+			c->cmdq_len++;
+			/* the argv array now belongs to the queue */
+			c->argv = NULL;
+			c->argc = 0;
+		}
+		resetClient(c);
+	}
 
-static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask)
+	if (c->qb_pos) {
+		sdsrange(c->querybuf,c->qb_pos,-1);
+		c->qb_pos = 0;
+	}
+}
+
+/* Run the commands an I/O thread queued for c. The argv of a command the
+ * parser is still reading stays aside meanwhile. A command that waits for
+ * a job keeps its argv in place and the commands after it stay queued,
+ * until unblockShardClient(). */
+void processParsedCommands(client *c)
+{
+	int argc = c->argc, i = 0, j;
+	sds *argv = c->argv;
+
+	if (c->flags & CLIENT_SHARD_WAIT) return;
+	while (i < c->cmdq_len) {
+		c->argc = c->cmdq[i].argc;
+		c->argv = c->cmdq[i++].argv;
+		processCommand(c);
+		if (c->flags & CLIENT_SHARD_WAIT) break;
+		for (j = 0; j < c->argc; j++) sdsfree(c->argv[j]);
+		zfree(c->argv);
+		c->cmd = NULL;
+	}
+	c->cmdq_len -= i;
+	memmove(c->cmdq, c->cmdq + i, sizeof(parsedCommand)*c->cmdq_len);
+
+	if (c->flags & CLIENT_SHARD_WAIT) {
+		c->parser.argc = argc;
+		c->parser.argv = argv;
+		c->flags |= CLIENT_PARSER_ASIDE;
+		return;
+	}
+	c->argc = argc;
+	c->argv = argv;
+}
+
+/* Read what the socket of c holds into its query buffer. Return 1 when
+ * something was read, 0 when there was nothing to read and the buffer was
+ * given back, -1 when the client must be closed. */
+static int readClientQuery(client *c)
 {
-	client *c = (client*) privdata;
 	int nread, readlen;
 	size_t qblen;
-	UNUSED(el);
-	UNUSED(mask);
 
 	readlen = PROTO_IOBUF_LEN;
 	/* If this is a multi bulk request, and we are processing a bulk reply
@@ -517,33 +771,115 @@ static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mas
 		if (remaining < readlen) readlen = remaining;
 	}
 
+	/* Without pending input read into the shared buffer, most reads hold
+	 * whole commands and leave nothing behind. */
+	if (c->querybuf == NULL) {
+		c->querybuf = *shared_qb;
+		c->flags |= CLIENT_SHARED_QUERYBUF;
+	}
+
 	qblen = sdslen(c->querybuf);
-	if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+	if (c->querybuf_peak < qblen + readlen) c->querybuf_peak = qblen + readlen;
 	c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
-	nread = read(fd, c->querybuf+qblen, readlen);
+	if (c->flags & CLIENT_SHARED_QUERYBUF) *shared_qb = c->querybuf;
+	nread = read(c->fd, c->querybuf+qblen, readlen);
 	if (nread == -1) {
 		if (errno == EAGAIN) {
-			return;
+			releaseQueryBuffer(c);
+			return 0;
 		} else {
 			server_log(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-			freeClient(c);
-			return;
+			releaseQueryBuffer(c);
+			return -1;
 		}
 	} else if (nread == 0) {
 		server_log(LL_VERBOSE, "Client closed connection");
-		freeClient(c);
-		return;
+		releaseQueryBuffer(c);
+		return -1;
 	}
 
 	sdsIncrLen(c->querybuf,nread);
-	processInputBuffer(c);
+	c->lastinteraction = __atomic_load_n(&server.unixtime, __ATOMIC_RELAXED);
+	if (sdslen(c->querybuf) - c->qb_pos > server.client_max_querybuf_len) {
+		server_log(LL_WARNING, "Closing client that reached max query buffer length (%zu bytes)",
+				sdslen(c->querybuf) - c->qb_pos);
+		releaseQueryBuffer(c);
+		return -1;
+	}
+	return 1;
+}
+
+static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask)
+{
+	client *c = (client*) privdata;
+	int ret;
+	UNUSED(el);
+	UNUSED(fd);
+	UNUSED(mask);
 
+	/* with I/O threads active the read waits for beforeSleep() */
+	if (postponeClientRead(c)) return;
+
+	ret = readClientQuery(c);
+	if (ret < 0) {
+		freeClient(c);
+	} else if (ret > 0) {
+		processInputBuffer(c);
+		releaseQueryBuffer(c);
+	}
 	return;
 }
 
+/* The shards ran the command of c: go on with its pending input. */
+void unblockShardClient(client *c)
+{
+	c->flags &= ~CLIENT_SHARD_WAIT;
+	if (c->flags & CLIENT_CLOSE_ASAP) {
+		freeClient(c);
+		return;
+	}
+
+	/* the command came from an I/O thread, whose parser may be halfway
+	 * through the next one: run the commands queued after it */
+	if (c->flags & CLIENT_PARSER_ASIDE) {
+		int j;
+
+		c->flags &= ~CLIENT_PARSER_ASIDE;
+		for (j = 0; j < c->argc; j++) sdsfree(c->argv[j]);
+		zfree(c->argv);
+		c->argc = c->parser.argc;
+		c->argv = c->parser.argv;
+		c->cmd = NULL;
+		processParsedCommands(c);
+		if (c->flags & CLIENT_SHARD_WAIT) return;
+	} else {
+		resetClient(c);
+	}
+	if (c->querybuf) {
+		processInputBuffer(c);
+		releaseQueryBuffer(c);
+	}
+}
+
+/* Read and parse for the main thread, called from an I/O thread. Nothing
+ * global is touched, a client to close is only flagged. */
+void ioThreadReadClient(client *c)
+{
+	int ret = readClientQuery(c);
+
+	if (ret < 0) {
+		c->flags |= CLIENT_CLOSE_ASAP;
+	} else if (ret > 0) {
+		/* a waiting command's argv is still in use, see processInputBuffer() */
+		if (!(c->flags & CLIENT_SHARD_WAIT)) parseInputBuffer(c);
+		releaseQueryBuffer(c);
+	}
+}
+
+
 
 
-client *createClient(int fd)
+client *createClient(int fd, int flags)
 {
 	client *c = zmalloc(sizeof(client));
 
@@ -552,11 +888,16 @@ client *createClient(int fd)
 	 * in the context of a client. When commands are executed in other
 	 * contexts (for instance a Lua script) we need a non connected client. */
 	if (fd != -1) {
+#ifndef HAVE_ACCEPT4
+		/* accept4() already made it non blocking */
 		anetNonBlock(NULL, fd);
-		anetEnableTcpNoDelay(NULL, fd);
-		anetKeepAlive(NULL, fd, SERVER_KEEPALIVE_INTERVAL);
+#endif
+		if (!(flags & CLIENT_UNIX_SOCKET)) {
+			anetEnableTcpNoDelay(NULL, fd);
+			anetKeepAlive(NULL, fd, SERVER_KEEPALIVE_INTERVAL);
+		}
 
-		if (aeCreateFileEvent(server.el, fd, AE_READABLE,
+		if (aeCreateFileEvent(serverTL->el, fd, AE_READABLE,
 					readQueryFromClient, c) == AE_ERR) {
 			close(fd);
 			zfree(c);
@@ -565,22 +906,64 @@ client *createClient(int fd)
 	}
 
 	c->fd = fd;
+	c->buf = NULL;
 	c->bufpos = 0;
-	c->querybuf = sdsempty();
+	c->sentlen = 0;
+	c->reply = listCreate();
+	c->reply_bytes = 0;
+	c->refs_node = NULL;
+	c->cmdq = NULL;
+	c->cmdq_len = c->cmdq_cap = 0;
+	listSetFreeMethod(c->reply, freeClientReplyValue);
+	c->querybuf = NULL;
+	c->qb_pos = 0;
 	c->querybuf_peak = 0;
+	c->lastinteraction = __atomic_load_n(&server.unixtime, __ATOMIC_RELAXED);
 	c->reqtype = 0;
 	c->argc = 0;
 	c->argv = NULL;
-	c->flags = 0;
+	c->flags = flags;
 	c->bulklen = -1;
 	c->multibulklen = 0;
+	c->client_node = NULL;
+	if (fd != -1) {
+		listAddNodeTail(serverTL->clients, c);
+		c->client_node = listLast(serverTL->clients);
+		__atomic_add_fetch(&server.connected_clients, 1, __ATOMIC_RELAXED);
+	}
 	return c;
 }
 
 
 static void acceptCommonHandler(int fd, int flags, char *ip)
 {
-	client *c = createClient(fd);
+	client *c;
+	UNUSED(ip);
+
+	/* Refuse the connection once maxclients is reached. The error is
+	 * written straight to the socket, no client is created for it. */
+	if (__atomic_load_n(&server.connected_clients, __ATOMIC_RELAXED) >= server.maxclients) {
+		char *err = "-ERR max number of clients reached\r\n";
+
+		/* best effort, the socket is non blocking */
+		if (write(fd, err, strlen(err)) == -1) {
+			/* Nothing to do, Just to avoid the warning... */
+		}
+		close(fd);
+		return;
+	}
+
+	/* An fd can be beyond the event loop set while the server holds fds
+	 * of its own, grow the set rather than turning the client away. */
+	if (fd >= aeGetSetSize(serverTL->el) &&
+		aeResizeSetSize(serverTL->el, fd + CONFIG_FDSET_INCR) == AE_ERR)
+	{
+		server_log(LL_WARNING, "Unable to grow the event loop for fd %d", fd);
+		close(fd);
+		return;
+	}
+
+	c = createClient(fd, flags);
 	if (c == NULL) {
 		server_log(LL_WARNING,
 			"Error registering fd event for the new client: %s (fd=%d)",
@@ -596,25 +979,152 @@ static void acceptCommonHandler(int fd, int flags, char *ip)
 static void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask)
 {
 
-	int cfd, cport;
+	int cfd, cport, max = MAX_ACCEPTS_PER_CALL;
 	char cip[NET_IP_STR_LEN];
 	UNUSED(el);
 	UNUSED(mask);
 	UNUSED(privdata);
 
-	cfd = anetTcpAccept(server.neterr, fd, cip, sizeof(cip), &cport);
-	if (cfd == ANET_ERR) {
-		if (errno != EWOULDBLOCK) {
-			/* ERROR LOG */
+	/* Drain the accept queue, bounded so a connection storm can not starve
+	 * the clients already connected. */
+	while (max--) {
+		cfd = anetTcpAccept(serverTL->neterr, fd, cip, sizeof(cip), &cport);
+		if (cfd == ANET_ERR) {
+			if (errno != EWOULDBLOCK) {
+				server_log(LL_WARNING, "Accepting client connection: %s", serverTL->neterr);
+			}
 			return;
 		}
+
+		server_log(LL_VERBOSE,"Accepted %s:%d", cip, cport);
+		acceptCommonHandler(cfd, 0, cip);
 	}
+	return;
+}
+
+static void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask)
+{
+	int cfd, max = MAX_ACCEPTS_PER_CALL;
+	UNUSED(el);
+	UNUSED(mask);
+	UNUSED(privdata);
+
+	while (max--) {
+		cfd = anetUnixAccept(serverTL->neterr, fd);
+		if (cfd == ANET_ERR) {
+			if (errno != EWOULDBLOCK) {
+				server_log(LL_WARNING, "Accepting client connection: %s", serverTL->neterr);
+			}
+			return;
+		}
 
-	server_log(LL_VERBOSE,"Accepted %s:%d", cip, cport);
-	acceptCommonHandler(cfd, 0, cip);
+		server_log(LL_VERBOSE,"Accepted connection to %s", server.unixsocket);
+		acceptCommonHandler(cfd, CLIENT_UNIX_SOCKET, NULL);
+	}
 	return;
 }
 
+/* Return the index entry holding key, or NULL if the key does not exist. */
+index_entry *lookupKey(sds key)
+{
+	/* the dict maps the key straight to its index entry */
+	if (serverTL->dict == NULL) return index_lookup(serverTL->idx, key);
+	return dictFetchValue(serverTL->dict, key);
+}
+
+static index_entry *insertVal(sds key, sds val, int move)
+{
+	if (move) return index_insert_owned(serverTL->idx, key, val);
+	return index_insert(serverTL->idx, key, val, sdslen(val));
+}
+
+static index_entry *updateVal(index_entry *e, sds val, int move)
+{
+	if (move) return index_update_owned(serverTL->idx, e, val);
+	return index_update(serverTL->idx, e, val, sdslen(val));
+}
+
+/* Called before any write of the shard's keyspace: jobs of other shards
+ * write too, not only the write commands. */
+static void keyspaceWillChange(void)
+{
+	/* values referenced by pending replies may be about to change */
+	if (listLength(serverTL->clients_reply_refs)) materializeReplyRefs();
+}
+
+static int setKeyGeneric(sds key, sds val, int move)
+{
+	dictEntry *de;
+	index_entry *e;
+
+	keyspaceWillChange();
+	if (snapshotsOpen()) snapshotRecordWrite(key, lookupKey(key));
+	if (serverTL->dict == NULL) {
+		e = insertVal(key, val, move);
+		return e ? SERVER_OK : SERVER_ERR;
+	}
+
+	de = dictFind(serverTL->dict, key);
+	if (de) {
+		e = updateVal(dictGetVal(de), val, move);
+		if (e == NULL) return SERVER_ERR;
+		/* a grown value may move the entry, and the dict borrows its key */
+		dictSetKey(serverTL->dict, de, ENTRY_KEY(e));
+		dictSetVal(serverTL->dict, de, e);
+	} else {
+		e = insertVal(key, val, move);
+		if (e == NULL) return SERVER_ERR;
+		dictAdd(serverTL->dict, ENTRY_KEY(e), e);
+	}
+
+	return SERVER_OK;
+}
+
+/* Add key or overwrite its value. Return SERVER_ERR on out of memory, in
+ * which case the store is left unchanged. */
+int setKey(sds key, sds val)
+{
+	return setKeyGeneric(key, val, 0);
+}
+
+/* Like setKey(), but val is handed over: on success it belongs to the
+ * store and the caller must drop its pointer. Large values are then kept
+ * as they are rather than copied into the entry. */
+int setKeyMove(sds key, sds val)
+{
+	/* small values are cheaper to copy than to keep out of line. An owned
+	 * value is attached to its entry once linked, too late for the readers
+	 * of other shards */
+	if (server.fl || sdslen(val) < STORE_VAL_MOVE_MIN || shardReadsInPlace()) {
+		if (setKey(key, val) == SERVER_ERR) return SERVER_ERR;
+		sdsfree(val);
+		return SERVER_OK;
+	}
+	return setKeyGeneric(key, val, 1);
+}
+
+/* Remove key, return SERVER_ERR if it does not exist. */
+int deleteKey(sds key)
+{
+	index_entry *e;
+
+	keyspaceWillChange();
+	if (snapshotsOpen() && (e = lookupKey(key)) != NULL) {
+		snapshotRecordWrite(key, e);
+	}
+	if (serverTL->dict == NULL) {
+		return index_delete(serverTL->idx, key) == 0 ? SERVER_OK : SERVER_ERR;
+	}
+
+	/* the entry owns the key, so unlink the dict entry first */
+	if (dictDelete(serverTL->dict, key) == DICT_ERR) {
+		return SERVER_ERR;
+	}
+
+	index_delete(serverTL->idx, key);
+	return SERVER_OK;
+}
+
 void loadDb()
 {
 	/* check file existence */
@@ -630,18 +1140,28 @@ void loadDb()
 	sds *kvs;
 	int count;
 
-	while ((nread = getline(&line, &len, fp) != -1)) {
-		sds tmp = sdsnewlen(line, len - 2);
+	while ((nread = getline(&line, &len, fp)) != -1) {
+		/* drop the trailing '\n' */
+		if (nread > 0 && line[nread - 1] == '\n') nread--;
+		sds tmp = sdsnewlen(line, nread);
 		kvs = sdssplitlen(tmp, sdslen(tmp), " ", 1, &count);
 		if (count != 2) {
 			server_log(LL_WARNING, "Data file format error, load failed.");
 			exit(1);
 		}
-		
-		/* just add raw key to dict */
-		dictAddRaw(server.dict, sdsdup(kvs[0]));	
-		/* insert into skiplist */
-		insert_skiplist(server.sl, kvs[0], kvs[1]);
+		if (server.fl && (sdslen(kvs[0]) != server.fl->key_len ||
+					sdslen(kvs[1]) != server.fl->val_len)) {
+			server_log(LL_WARNING, "Data file does not match fixed-length %u %u, load failed.",
+						server.fl->key_len, server.fl->val_len);
+			exit(1);
+		}
+
+		/* the threads are not started yet, fill the shards in turn */
+		serverTL = &server.shards[shardOfKey(kvs[0])];
+		if (setKey(kvs[0], kvs[1]) == SERVER_ERR) {
+			server_log(LL_WARNING, "Out of memory loading data file.");
+			exit(1);
+		}
 
 		sdsfreesplitres(kvs, count);
 		sdsfree(tmp);
@@ -650,12 +1170,140 @@ void loadDb()
 
 	free(line);
 	fclose(fp);
+	serverTL = &server.shards[0];
 	return;
 }
 
 
+/* Raise the open files limit to serve maxclients, plus the fds the server
+ * needs for itself. If the limit cannot be raised that far, maxclients is
+ * lowered to what it allows. */
+static void adjustOpenFilesLimit(void)
+{
+	rlim_t maxfiles = server.maxclients + CONFIG_MIN_RESERVED_FDS;
+	struct rlimit limit;
+
+	if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+		server_log(LL_WARNING, "Unable to obtain the current NOFILE limit (%s), "
+				"assuming 1024 and setting the max clients configuration accordingly.",
+				strerror(errno));
+		server.maxclients = 1024 - CONFIG_MIN_RESERVED_FDS;
+		return;
+	}
+
+	rlim_t oldlimit = limit.rlim_cur, oldmax = limit.rlim_max;
+	if (oldlimit >= maxfiles) return;
+
+	/* Try the wanted limit first, then step down until one is accepted. */
+	rlim_t bestlimit = maxfiles;
+	int setrlimit_error = 0;
+
+	while (bestlimit > oldlimit) {
+		limit.rlim_cur = bestlimit;
+		limit.rlim_max = bestlimit > oldmax ? bestlimit : oldmax;
+		if (setrlimit(RLIMIT_NOFILE, &limit) != -1) break;
+		setrlimit_error = errno;
+		if (bestlimit < 16) {
+			bestlimit = oldlimit;
+			break;
+		}
+		bestlimit -= 16;
+	}
+	if (bestlimit < oldlimit) bestlimit = oldlimit;
+
+	if (bestlimit < maxfiles) {
+		unsigned int old_maxclients = server.maxclients;
+
+		if (bestlimit <= CONFIG_MIN_RESERVED_FDS) {
+			server_log(LL_WARNING, "Your current 'ulimit -n' of %llu is not enough "
+					"for the server to start. Please increase your open file limit "
+					"to at least %llu. Exiting.",
+					(unsigned long long)oldlimit, (unsigned long long)maxfiles);
+			exit(1);
+		}
+		server.maxclients = bestlimit - CONFIG_MIN_RESERVED_FDS;
+		server_log(LL_WARNING, "You requested maxclients of %u requiring at least "
+				"%llu max file descriptors.", old_maxclients,
+				(unsigned long long)maxfiles);
+		server_log(LL_WARNING, "Server can't set maximum open files to %llu "
+				"because of OS error: %s.", (unsigned long long)maxfiles,
+				strerror(setrlimit_error));
+		server_log(LL_WARNING, "Current maximum open files is %llu. maxclients "
+				"has been reduced to %u to compensate for low ulimit.",
+				(unsigned long long)bestlimit, server.maxclients);
+	} else {
+		server_log(LL_NOTICE, "Increased maximum number of open files to %llu "
+				"(it was originally set to %llu).",
+				(unsigned long long)maxfiles, (unsigned long long)oldlimit);
+	}
+}
+
+static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData);
+static void beforeSleep(struct aeEventLoop *eventLoop);
+
+/* Create the event loop, the listeners and the index of shard s. */
+static void initShard(dbShard *s, int id)
+{
+	int j;
+
+	serverTL = s;
+	s->id = id;
+	s->el = aeCreateEventLoop(server.maxclients + CONFIG_FDSET_INCR);
+	if (s->el == NULL) {
+		server_log(LL_WARNING, "Failed creating the event loop. Error message: '%s'",
+				strerror(errno));
+		exit(1);
+	}
+	s->clients = listCreate();
+	s->clients_pending_write = listCreate();
+	s->clients_reply_refs = listCreate();
+	s->jobs_yielded = listCreate();
+
+	/* create socket server and listen */
+	if (listenToPort(server.port, s->ipfd, &s->ipfd_count) == SERVER_ERR) {
+		server_log(LL_WARNING, "Listen to port %d error", server.port);
+		exit(1);
+	}
+
+	/* create the ordered index, and the hashmap unless the engine serves
+	 * point lookups itself */
+	if (!server.index_engine->point_lookup) {
+		s->dict = dictCreate(&slDictType, NULL);
+	}
+	s->idx = index_create(server.index_engine);
+	s->versions = NULL;
+	if (s->idx == NULL) {
+		server_panic("Unrecoverable error creating index.");
+	}
+	/* every entry has the same size in fixed-length mode, use slab slots */
+	if (server.fl && index_use_slab(s->idx, server.fl->key_len,
+							server.fl->val_len) == -1 && id == 0) {
+		server_log(LL_WARNING, "%s index can not use a slab arena, fall back to malloc",
+					server.index_engine->name);
+	}
+
+	/* create file events to handle connection requests */
+	for (j = 0; j < s->ipfd_count; j++) {
+		if (aeCreateFileEvent(s->el, s->ipfd[j], AE_READABLE,
+								acceptTcpHandler, NULL) == AE_ERR) {
+			server_panic("Unrecoverable error creating file event.");
+		}
+	}
+
+	/* execute every 100ms */
+	if (aeCreateTimeEvent(s->el, SERVER_CRON_PERIOD, serverCron,
+				NULL, NULL) == AE_ERR) {
+		server_panic("Unrecoverable error creating time event.");
+	}
+	aeSetBeforeSleepProc(s->el, beforeSleep);
+
+	if (server.shard_num > 1) initShardQueue(s);
+}
+
 void initDb()
 {
+	int j;
+
 	/* signal handle */
 	signal(SIGHUP, SIG_IGN);
 	signal(SIGPIPE, SIG_IGN);
@@ -665,28 +1313,40 @@ void initDb()
     srand((unsigned)time(NULL));	
 
 	server.pid = getpid();
-	server.el = aeCreateEventLoop(MAX_EVENT_SIZE);
+	adjustOpenFilesLimit();
+	if (server.io_uring && aeSetIouring(1) == AE_ERR) {
+		server_log(LL_WARNING, "io_uring support is not compiled in, using %s",
+				aeGetApiName());
+	}
+	server.clients_pending_read = listCreate();
+	server.shared_qb = sdsMakeRoomFor(sdsempty(), PROTO_IOBUF_LEN);
+	initSnapshots();
 
 	/* init commands */
 	populateCommandTable();
 
-	/* create socket server and listen */
-	if ((server.sock_fd = listenToPort(server.port)) == SERVER_ERR) {
-		server_log(LL_WARNING, "Listen to port %d error", server.port);
+	checkTcpBacklogSettings();
+	/* backwards, the main thread is left on shard 0, which it runs */
+	server.shards = zcalloc(sizeof(dbShard) * server.shard_num);
+	for (j = server.shard_num - 1; j >= 0; j--) {
+		initShard(&server.shards[j], j);
+	}
+	if (serverTL->el->apiuring) {
+		server_log(LL_NOTICE, "Event loop uses io_uring");
+	} else if (server.io_uring) {
+		server_log(LL_WARNING, "The kernel refused io_uring, using %s", aeGetApiName());
+	}
+	if (server.unixsocket != NULL && listenToUnixSocket() == SERVER_ERR) {
 		exit(1);
 	}
+	atexit(closeListeningSockets);
 
-	/* create skiplist and hashmap */
-	server.dict = dictCreate(&slDictType, NULL);
-	server.sl = create_skiplist();
-	
 	/* load data from data file */
 	loadDb();
 
-	/* create file event to handle connection request */
-	if (aeCreateFileEvent(server.el, server.sock_fd, AE_READABLE,
-							acceptTcpHandler, NULL) == AE_ERR) {
-		server_panic("Unrecoverable error creating file event.");
+	if (server.sofd != -1 && aeCreateFileEvent(serverTL->el, server.sofd, AE_READABLE,
+							acceptUnixHandler, NULL) == AE_ERR) {
+		server_panic("Unrecoverable error creating server.sofd file event.");
 	}
 
 #if 0
@@ -704,10 +1364,19 @@ void saveDb()
 	FILE *fp = fopen(tmpfile, "w");
 	assert(fp != NULL);
 
-	sl_node *node = server.sl->head->next[0];
-	while (node) {
-		fprintf(fp, "%s %s\n", node->key, node->val);
-		node = node->next[0];
+	/* the shards are stopped, and in key order */
+	int j;
+	for (j = 0; j < server.shard_num; j++) {
+		index_iter it;
+		index_entry *e = index_first(server.shards[j].idx, &it);
+		while (e) {
+			sds key = ENTRY_KEY(e);
+			fwrite(key, 1, sdslen(key), fp);
+			fputc(' ', fp);
+			fwrite(ENTRY_VAL(e), 1, e->vlen, fp);
+			fputc('\n', fp);
+			e = index_next(&it);
+		}
 	}
 
 	fclose(fp);
@@ -715,6 +1384,97 @@ void saveDb()
 	return;
 }
 
+/* Shrink the query buffer of c when it is idle or far larger than its
+ * recent peak. Buffers without pending input were already given back after
+ * the read. */
+static void clientsCronResizeQueryBuffer(client *c)
+{
+	size_t querybuf_size, idletime;
+
+	if (c->querybuf == NULL) return;
+
+	querybuf_size = sdsAllocSize(c->querybuf);
+	idletime = __atomic_load_n(&server.unixtime, __ATOMIC_RELAXED) - c->lastinteraction;
+
+	if (querybuf_size > PROTO_RESIZE_THRESHOLD &&
+		(querybuf_size/(c->querybuf_peak+1) > 2 || idletime > CLIENT_IDLE_SHRINK_TIME))
+	{
+		if (c->qb_pos == 0 && sdsavail(c->querybuf) > 1024*4) {
+			c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+		}
+	}
+	/* the peak is measured again until the next check */
+	c->querybuf_peak = 0;
+}
+
+/* Drop the reply buffer of a client idle with nothing left to send, it is
+ * allocated again on the next reply. */
+static void clientsCronFreeReplyBuffer(client *c)
+{
+	time_t idletime = __atomic_load_n(&server.unixtime, __ATOMIC_RELAXED) - c->lastinteraction;
+
+	if (c->buf && c->bufpos == 0 && idletime > CLIENT_IDLE_SHRINK_TIME) {
+		zfree(c->buf);
+		c->buf = NULL;
+	}
+}
+
+/* Check a slice of the clients on every call, so that all of them are seen
+ * about once a second. */
+static void clientsCron(void)
+{
+	int numclients = listLength(serverTL->clients);
+	int iterations = numclients / (1000 / SERVER_CRON_PERIOD);
+
+	if (iterations < CLIENTS_CRON_MIN_ITERATIONS) {
+		iterations = numclients < CLIENTS_CRON_MIN_ITERATIONS ?
+			numclients : CLIENTS_CRON_MIN_ITERATIONS;
+	}
+	while (listLength(serverTL->clients) && iterations--) {
+		listNode *head;
+		client *c;
+
+		/* rotate the list, the head goes to the tail */
+		head = listFirst(serverTL->clients);
+		c = listNodeValue(head);
+		listDelNode(serverTL->clients, head);
+		listAddNodeTail(serverTL->clients, c);
+		c->client_node = listLast(serverTL->clients);
+
+		clientsCronResizeQueryBuffer(c);
+		clientsCronFreeReplyBuffer(c);
+	}
+}
+
+static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData)
+{
+	UNUSED(eventLoop);
+	UNUSED(id);
+	UNUSED(clientData);
+
+	/* the other shards and the I/O threads only read it */
+	if (serverTL->id == 0) {
+		__atomic_store_n(&server.unixtime, time(NULL), __ATOMIC_RELAXED);
+	}
+	clientsCron();
+	snapshotCron();
+	return SERVER_CRON_PERIOD;
+}
+
+/* This function gets called every time the event loop is about to enter
+ * the main loop of the event driven library, that is, before to sleep
+ * for ready file descriptors. */
+static void beforeSleep(struct aeEventLoop *eventLoop)
+{
+	UNUSED(eventLoop);
+
+	/* Read and parse in the I/O threads, run the commands and the next
+	 * slice of long jobs, then write with pending output buffers. */
+	handleClientsWithPendingReadsUsingThreads();
+	shardResumeJobs();
+	handleClientsWithPendingWritesUsingThreads();
+}
+
 int main(int argc, char *argv[])
 {
 	/* analyse input parameters */
@@ -730,23 +1490,20 @@ int main(int argc, char *argv[])
 	if (server.daemonize) daemonize();
 
 	initDb();
+	initThreadedIO();
 	if (server.daemonize || server.pidfile) {
 		createPidFile();
 	}
 	setproctitle("%s *:%d", argv[0], server.port);
 
 	atexit(saveDb);
+	/* runs first, saveDb() needs the shards stopped */
+	atexit(stopShards);
+	startShards();
 
-#if 0
-	/* execute every 100ms */
-	if (aeCreateTimeEvent(server.el, 100, serverCron,
-				NULL, NULL) == AE_ERR) {
-		server_panic("Unrecoverable error creating time event.");
-	}
-#endif
-
-	aeMain(server.el);
-	aeDeleteEventLoop(server.el);
+	aeMain(serverTL->el);
+	aeDeleteEventLoop(serverTL->el);
+	serverTL->el = NULL;
 
 	return 0;
 }
@@ -5,14 +5,18 @@
 #include "sds.h"
 #include "zmalloc.h"
 #include "dict.h"
+#include "adlist.h"
 #include "ae.h"
 #include "anet.h"
-#include "skiplist.h"
+#include "index.h"
 #include "hiredis.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
 #include <assert.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
 /*-----------------------------------------------------------------------------
  * Macros
@@ -23,25 +27,81 @@
 
 /* Misc */
 #define SERVER_KEEPALIVE_INTERVAL 60
+#define SERVER_CRON_PERIOD 100      /* Milliseconds between cron runs */
+#define CLIENTS_CRON_MIN_ITERATIONS 5
+#define CLIENT_IDLE_SHRINK_TIME 2   /* Seconds before an idle buffer shrinks */
+#define UNUSED(V) ((void) V)
+
+/* Client limits */
+#define CONFIG_DEFAULT_MAX_CLIENTS 10000
+#define CONFIG_MIN_RESERVED_FDS 32  /* fds kept for logs, the data file and listeners */
+#define CONFIG_FDSET_INCR (CONFIG_MIN_RESERVED_FDS+96)
+#define CONFIG_DEFAULT_TCP_BACKLOG 511  /* TCP listen backlog */
+#define CONFIG_MAX_LISTENERS 16  /* max SO_REUSEPORT listeners, see tcp-listeners */
+#define MAX_ACCEPTS_PER_CALL 1000  /* connections accepted per readable event */
+#define CONFIG_DEFAULT_UNIX_SOCKET_PERM 0
+#define CONFIG_MAX_SHARDS 64        /* max shards, see shards */
+#define CONFIG_DEFAULT_SNAPSHOT_MAX_AGE 60 /* seconds, see snapshot-max-age */
 
 /* Protocol and I/O related defines */
 #define PROTO_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
+#define PROTO_RESIZE_THRESHOLD  (1024*32) /* Threshold for determining whether to resize query buffer */
 #define PROTO_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_REPLY_LIST_CHUNK  (1024*16)  /* Small replies are packed in list nodes of this size */
+#define PROTO_REPLY_REF_MIN     (1024)     /* Values referenced in place rather than copied */
+#define STORE_VAL_MOVE_MIN      (1024*4)   /* Values moved into the store rather than copied */
+#define SCAN_SLICE_KEYS         (1024)     /* Keys a scan visits before yielding */
+#define SCAN_REPLY_PENDING_MAX  (1024*1024) /* Unsent reply bytes pausing a scan or ending a page */
+#define NET_MAX_WRITES_PER_EVENT (1024*64) /* Bytes written to a client in one go */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 
+/* Client flags */
+#define CLIENT_PENDING_WRITE (1<<0) /* Client has output to send but a write
+                                       handler is yet not installed. */
+#define CLIENT_REPLY_REFS (1<<1)    /* Reply list references index values. */
+#define CLIENT_SHARED_QUERYBUF (1<<2) /* Query buffer is server.shared_qb. */
+#define CLIENT_UNIX_SOCKET (1<<3)   /* Client connected via Unix domain socket. */
+#define CLIENT_PENDING_READ (1<<4)  /* Queued for an I/O thread to read. */
+#define CLIENT_CLOSE_ASAP (1<<5)    /* An I/O thread failed on it, free it. */
+#define CLIENT_SHARD_WAIT (1<<6)    /* A job runs its command, see shard.h */
+#define CLIENT_SHARD_PROXY (1<<7)   /* Runs commands of other shards' clients. */
+#define CLIENT_PARSER_ASIDE (1<<8)  /* The waiting command came from cmdq. */
+
+/* Command flags */
+#define CMD_WRITE (1<<0)            /* The command may modify the keyspace. */
+#define CMD_KEY (1<<1)              /* argv[1] is its only key, the shard owning
+                                       the key runs it. */
+
 /* Client request types */
 #define PROTO_REQ_INLINE 1
 #define PROTO_REQ_MULTIBULK 2
 
 typedef long long mstime_t; /*  millisecond time type. */
 
+/* A reply list node: either a buffer of 'size' bytes of which 'used' are
+ * filled, or 'used' bytes referenced in place at 'ref' (size is 0). */
+typedef struct clientReplyBlock {
+    size_t size, used;
+    const char *ref;
+    char buf[];
+} clientReplyBlock;
+
+/* A command parsed by an I/O thread, waiting for the main thread. */
+typedef struct parsedCommand {
+    int argc;
+    sds *argv;
+} parsedCommand;
+
 typedef struct serverClient{
     int fd;
     size_t querybuf_peak;
-    sds querybuf;
+    sds querybuf;           /* NULL while there is no pending input. */
+    size_t qb_pos;          /* Parsed up to here, trimmed after each read. */
+    time_t lastinteraction; /* Time of the last read. */
+    listNode *client_node;  /* Node in server.clients. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
     int flags;
@@ -50,9 +110,15 @@ typedef struct serverClient{
     int argc;
     sds *argv;
     struct server_command *cmd;
-    /*  Response buffer */
+    list *reply;            /* List of clientReplyBlock to send to the client. */
+    unsigned long long reply_bytes; /* Tot bytes of objects in reply list. */
+    listNode *refs_node;    /* Node in server.clients_reply_refs, if any. */
+    parsedCommand *cmdq;    /* Commands parsed by an I/O thread. */
+    int cmdq_len, cmdq_cap;
+    parsedCommand parser;   /* Parser argv set aside, see CLIENT_PARSER_ASIDE. */
+    /*  Response buffer, allocated on the first reply */
     int bufpos;
-    char buf[PROTO_REPLY_CHUNK_BYTES];
+    char *buf;
 } client;
 
 typedef void server_command_proc(client *c);
@@ -60,6 +126,7 @@ struct server_command {
     const char *name;
     server_command_proc *proc;
     int arity;
+    int flags;              /* CMD_* flags */
 };
 
 
@@ -68,26 +135,68 @@ struct fixed_length {
     unsigned int val_len;
 };
 
+/* A shard owns an event loop, the clients it accepted and a range of the
+ * keys. Each runs in a thread of its own, which sees it as serverTL. */
+typedef struct dbShard {
+	int id;
+	pthread_t thread;
+	aeEventLoop *el;
+	int ipfd[CONFIG_MAX_LISTENERS]; /* TCP listening sockets */
+	int ipfd_count;             /* Used slots in ipfd[] */
+	char neterr[ANET_ERR_LEN];  /* Error buffer for anet.c */
+	list *clients;              /* All the clients, rotated by the cron. */
+	list *clients_pending_write; /* There is to write or install handler. */
+	list *clients_reply_refs;   /* Clients whose replies reference values. */
+	dict *dict;	  /* hashmap from keys to their index entries */
+	ordered_index *idx; /* ordered index to keep the kv pairs sorted */
+	struct shardJob *queue;     /* Jobs pushed by other shards, newest first. */
+	int notify_fd;              /* eventfd written when the queue was empty */
+	int stop;                   /* Leave the event loop. */
+	client *proxy;              /* Runs commands for other shards' clients. */
+	list *jobs_yielded;         /* Jobs to resume on the next tick. */
+	ordered_index *versions;    /* Replaced values kept for snapshots, or NULL. */
+} dbShard;
+
 struct dbServer {
 	pid_t pid;
-	int sock_fd;
 	int port;
+	int tcp_backlog;            /* TCP listen() backlog */
+	int tcp_listeners;          /* Listeners sharing the port with SO_REUSEPORT */
+	char *unixsocket;           /* UNIX socket path, NULL when not listening */
+	mode_t unixsocketperm;      /* UNIX socket permission */
+	int sofd;                   /* Unix socket file descriptor */
+	int io_uring;               /* Wait for events with io_uring, not epoll */
 	int verbosity;  /* Loglevel in configure file */
 	int daemonize;
 	int repl_timeout;
 
-	aeEventLoop *el;
+	dbShard *shards;            /* shard_num shards, the first is the main thread */
+	int shard_num;
+	sds *shard_bounds;          /* First key of every shard but the first. */
+	int shard_bounds_num;
+	volatile sig_atomic_t shutdown_asap; /* Shard 0 exits on its next wakeup. */
+	unsigned long long snapshot_seq; /* Write sequence, see snapshot.c */
+	unsigned int snapshots_open;
+	list *snapshots;            /* Open snapshots, under snapshots_mutex. */
+	pthread_mutex_t snapshots_mutex;
+	int snapshot_max_age;       /* Seconds a scan may hold a snapshot, 0 no limit. */
 	char *config_file;
 	char *log_file;
 	char *pidfile;
 	char *db_filename;
 	dict *commands;             /*  Command table */
-	char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
-	dict *dict;	  /* hashmap to speed up lookup existence */
-	skiplist *sl; /* skiplist to score sorted kv pairs */
+	list *clients_pending_read; /* Clients waiting for an I/O thread to read. */
+	int io_threads_num;         /* Threads doing client I/O, main included. */
+	index_type *index_engine; /* engine of idx, see index-engine */
 
 	struct fixed_length *fl;
 	sds max_key;
+
+	sds shared_qb;              /* Read buffer of clients without pending input. */
+	size_t client_max_querybuf_len; /* Limit for client query buffer length */
+	unsigned int maxclients;    /* Max number of simultaneous clients */
+	unsigned int connected_clients; /* Clients of all the shards */
+	time_t unixtime;            /* Unix time sampled every cron cycle. */
 };
 
 
@@ -95,6 +204,7 @@ struct dbServer {
  * Extern declarations
  *----------------------------------------------------------------------------*/
 extern struct dbServer server;
+extern __thread dbShard *serverTL;
 extern dictType commandTableDictType;
 
 /*-----------------------------------------------------------------------------
@@ -105,6 +215,17 @@ void addReplyErrorFormat(client *c, const char *fmt, ...);
 
 void process_para(int argc, char *argv[]);
 void freeClient(client *c);
+void freeClientReplyValue(void *o);
+int clientHasPendingReplies(client *c);
+void handleClientsWithPendingWrites(void);
+int writeClientReplies(client *c);
+int finishClientWrite(client *c, int handler_installed);
+void ioThreadReadClient(client *c);
+void processParsedCommands(client *c);
+void initThreadQueryBuffer(void);
+void materializeReplyRefs(void);
+void addReplyBulkRef(client *c, const char *p, size_t len);
+void addReplyBulkCBuffer(client *c, const char *p, size_t len);
 void spt_init(int argc, char *argv[]);
 void setproctitle(const char *fmt, ...);
 void dictInstancesValDestructor(void *privdata, void *obj);
@@ -116,5 +237,14 @@ int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
 
 long long ustime(void);
 void addReplyString(client *c, const char *s, size_t len);
+sds convertToResp(const char *src, size_t len);
+index_entry *lookupKey(sds key);
+int setKey(sds key, sds val);
+int setKeyMove(sds key, sds val);
+int deleteKey(sds key);
 void resetClient(client *c);
+void call(client *c);
+client *createClient(int fd, int flags);
+void freeQueryBuffer(client *c);
+void unblockShardClient(client *c);
 #endif
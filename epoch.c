@@ -0,0 +1,141 @@
+#include "epoch.h"
+
+#include <stdlib.h>
+
+/* retirements between two attempts to advance the epoch */
+#define EPOCH_RECLAIM_EVERY 64
+
+/* A thread taking part in the protocol. Its state is the epoch it observed
+ * on entering a critical section shifted left by one with the low bit set,
+ * or 0 outside of one. Records are never freed. */
+typedef struct epoch_record {
+	struct epoch_record *next;
+	unsigned long state;
+} epoch_record;
+
+/* Memory waiting for the epoch to move two steps past its retirement. */
+typedef struct epoch_limbo {
+	struct epoch_limbo *next;
+	void *ptr;
+	epoch_free_fn *free_fn;
+	unsigned long epoch;
+} epoch_limbo;
+
+static unsigned long global_epoch = 1;
+static epoch_record *records;
+
+static __thread epoch_record *self;
+static __thread int nesting;
+/* retired by this thread, oldest first, so the head is freed first */
+static __thread epoch_limbo *limbo_head, *limbo_tail;
+static __thread unsigned long limbo_len;
+static __thread unsigned long retired;
+
+static void epoch_register(void)
+{
+	epoch_record *r = calloc(1, sizeof(*r));
+
+	if (!r) {
+		abort();
+	}
+	r->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&records, &r->next, r, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	self = r;
+}
+
+void epoch_enter(void)
+{
+	unsigned long e;
+
+	if (nesting++) {
+		return;
+	}
+	if (!self) {
+		epoch_register();
+	}
+	e = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+	__atomic_store_n(&self->state, (e << 1) | 1, __ATOMIC_RELAXED);
+	/* the state must be visible before any pointer of the structure is
+	 * read, pairs with the fence in epoch_advance() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit(void)
+{
+	if (--nesting) {
+		return;
+	}
+	__atomic_store_n(&self->state, 0, __ATOMIC_RELEASE);
+}
+
+/* Move the global epoch one step if every thread in a critical section has
+ * observed the current one, and return the global epoch. */
+static unsigned long epoch_advance(void)
+{
+	unsigned long e = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	epoch_record *r;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	for (r = __atomic_load_n(&records, __ATOMIC_ACQUIRE); r; r = r->next) {
+		unsigned long s = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+
+		if ((s & 1) && (s >> 1) != e) {
+			return e;
+		}
+	}
+	if (__atomic_compare_exchange_n(&global_epoch, &e, e + 1, 0,
+				__ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+		return e + 1;
+	}
+	return e;
+}
+
+/* Free ptr with free_fn once no thread can reach it. The caller has
+ * already unlinked it from the structure. */
+void epoch_retire(void *ptr, epoch_free_fn *free_fn)
+{
+	epoch_limbo *l = malloc(sizeof(*l));
+
+	if (!l) {
+		abort();
+	}
+	l->next = NULL;
+	l->ptr = ptr;
+	l->free_fn = free_fn;
+	l->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+	if (limbo_tail) {
+		limbo_tail->next = l;
+	} else {
+		limbo_head = l;
+	}
+	limbo_tail = l;
+	limbo_len++;
+	if (++retired % EPOCH_RECLAIM_EVERY == 0) {
+		epoch_reclaim();
+	}
+}
+
+/* Try to advance the epoch, then free what this thread retired and is no
+ * longer reachable. */
+void epoch_reclaim(void)
+{
+	unsigned long e = epoch_advance();
+	epoch_limbo *l;
+
+	while ((l = limbo_head) && l->epoch + 2 <= e) {
+		limbo_head = l->next;
+		if (!limbo_head) {
+			limbo_tail = NULL;
+		}
+		l->free_fn(l->ptr);
+		free(l);
+		limbo_len--;
+	}
+}
+
+/* Number of entries this thread retired that are not freed yet. */
+unsigned long epoch_pending(void)
+{
+	return limbo_len;
+}
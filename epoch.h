@@ -0,0 +1,22 @@
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+/* Epoch based reclamation. Memory unlinked from a structure that other
+ * threads read without locks is retired rather than freed: it is freed
+ * once every thread that could still hold a pointer to it has left its
+ * critical section.
+ *
+ * A thread reading or writing such a structure brackets the access with
+ * epoch_enter() and epoch_exit(), which nest. The global epoch advances
+ * when every thread inside a critical section has observed it, so memory
+ * retired in epoch e is unreachable by the time the epoch is e + 2. Each
+ * thread frees what it retired itself. */
+typedef void epoch_free_fn(void *ptr);
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, epoch_free_fn *free_fn);
+void epoch_reclaim(void);
+unsigned long epoch_pending(void);
+
+#endif
@@ -0,0 +1,294 @@
+#include "index.h"
+#include "skiplist.h"
+#include "cskiplist.h"
+#include "btree.h"
+#include "art.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static index_type *index_types[] = {
+	&skiplistIndexType,
+	&cskiplistIndexType,
+	&btreeIndexType,
+	&artIndexType,
+	NULL,
+};
+
+/* Return the engine registered as name, NULL if there is none. */
+index_type *index_type_lookup(const char *name)
+{
+	index_type **t;
+
+	for (t = index_types; *t; t++) {
+		if (!strcasecmp((*t)->name, name)) {
+			return *t;
+		}
+	}
+	return NULL;
+}
+
+ordered_index *index_create(index_type *type)
+{
+	ordered_index *idx = (ordered_index *)malloc(sizeof(ordered_index));
+	if (!idx) {
+		return NULL;
+	}
+
+	idx->type = type;
+	idx->ptr = type->create();
+	if (!idx->ptr) {
+		free(idx);
+		return NULL;
+	}
+	return idx;
+}
+
+void index_release(ordered_index *idx)
+{
+	if (!idx) {
+		return;
+	}
+
+	idx->type->release(idx->ptr);
+	free(idx);
+}
+
+/* Return -1 if the engine can not use a slab arena. */
+int index_use_slab(ordered_index *idx, size_t klen, size_t vlen)
+{
+	if (!idx->type->use_slab) {
+		return -1;
+	}
+	return idx->type->use_slab(idx->ptr, klen, vlen);
+}
+
+index_entry *index_insert(ordered_index *idx, sds key, const char *val, size_t vlen)
+{
+	return idx->type->insert(idx->ptr, key, val, vlen);
+}
+
+index_entry *index_update(ordered_index *idx, index_entry *e, const char *val, size_t vlen)
+{
+	return idx->type->update(idx->ptr, e, val, vlen);
+}
+
+/* Store a pointer to val in place of its bytes. */
+static index_entry *index_entry_own_val(index_entry *e, sds val)
+{
+	if (e) {
+		e->flags |= ENTRY_VAL_OWNED;
+		e->vlen = sdslen(val);
+	}
+	return e;
+}
+
+/* Like index_insert(), but the entry takes val over instead of copying it.
+ * On failure val still belongs to the caller. Not for slab backed indexes. */
+index_entry *index_insert_owned(ordered_index *idx, sds key, sds val)
+{
+	return index_entry_own_val(idx->type->insert(idx->ptr, key,
+				(const char *)&val, sizeof(val)), val);
+}
+
+index_entry *index_update_owned(ordered_index *idx, index_entry *e, sds val)
+{
+	return index_entry_own_val(idx->type->update(idx->ptr, e,
+				(const char *)&val, sizeof(val)), val);
+}
+
+index_entry *index_lookup(ordered_index *idx, sds key)
+{
+	return idx->type->lookup(idx->ptr, key);
+}
+
+int index_delete(ordered_index *idx, sds key)
+{
+	return idx->type->delete(idx->ptr, key);
+}
+
+unsigned long index_count(ordered_index *idx)
+{
+	return idx->type->count(idx->ptr);
+}
+
+index_entry *index_min(ordered_index *idx)
+{
+	index_iter it;
+
+	return index_first(idx, &it);
+}
+
+index_entry *index_max(ordered_index *idx)
+{
+	index_iter it;
+
+	return index_last(idx, &it);
+}
+
+index_entry *index_first(ordered_index *idx, index_iter *it)
+{
+	it->idx = idx;
+	return idx->type->first(idx->ptr, it);
+}
+
+index_entry *index_last(ordered_index *idx, index_iter *it)
+{
+	it->idx = idx;
+	return idx->type->last(idx->ptr, it);
+}
+
+/* Position it on the first entry >= key. */
+index_entry *index_seek(ordered_index *idx, index_iter *it, sds key)
+{
+	it->idx = idx;
+	return idx->type->seek(idx->ptr, it, key);
+}
+
+/* Position it on the last entry <= key. */
+index_entry *index_seek_last(ordered_index *idx, index_iter *it, sds key)
+{
+	index_entry *e = index_seek(idx, it, key);
+
+	if (!e) {
+		return index_last(idx, it);
+	}
+	if (index_key_compare(ENTRY_KEY(e), key) > 0) {
+		return index_prev(it);
+	}
+	return e;
+}
+
+index_entry *index_next(index_iter *it)
+{
+	return it->idx->type->next(it->idx->ptr, it);
+}
+
+index_entry *index_prev(index_iter *it)
+{
+	return it->idx->type->prev(it->idx->ptr, it);
+}
+
+/* Number of keys < key. */
+unsigned long index_rank(ordered_index *idx, sds key)
+{
+	unsigned long rank = 0;
+	index_iter it;
+	index_entry *e;
+
+	if (idx->type->rank) {
+		return idx->type->rank(idx->ptr, key);
+	}
+
+	for (e = index_first(idx, &it); e; e = index_next(&it)) {
+		if (index_key_compare(ENTRY_KEY(e), key) >= 0) {
+			break;
+		}
+		rank++;
+	}
+	return rank;
+}
+
+/* Number of keys in [start, end]. */
+unsigned long index_count_range(ordered_index *idx, sds start, sds end)
+{
+	unsigned long count = 0;
+	index_iter it;
+	index_entry *e;
+
+	if (index_key_compare(start, end) > 0) {
+		return 0;
+	}
+
+	if (idx->type->rank) {
+		count = idx->type->rank(idx->ptr, end) - idx->type->rank(idx->ptr, start);
+		return index_lookup(idx, end) ? count + 1 : count;
+	}
+
+	for (e = index_seek(idx, &it, start); e; e = index_next(&it)) {
+		if (index_key_compare(ENTRY_KEY(e), end) > 0) {
+			break;
+		}
+		count++;
+	}
+	return count;
+}
+
+sds index_info(ordered_index *idx, sds s)
+{
+	if (!idx->type->info) {
+		return s;
+	}
+	return idx->type->info(idx->ptr, s);
+}
+
+/* A thread reading an index that another thread writes does it between
+ * these two calls, and uses the entries it got only until the end. The
+ * thread writing the index needs neither. */
+void index_read_begin(ordered_index *idx)
+{
+	if (idx->type->read_begin) {
+		idx->type->read_begin(idx->ptr);
+	}
+}
+
+void index_read_end(ordered_index *idx)
+{
+	if (idx->type->read_end) {
+		idx->type->read_end(idx->ptr);
+	}
+}
+
+/* Binary safe lexicographic compare, a shorter key sorts before any longer
+ * key it is a prefix of. */
+int index_key_compare(sds key1, sds key2)
+{
+	size_t l1, l2, minlen;
+	int cmp;
+
+	l1 = sdslen(key1);
+	l2 = sdslen(key2);
+	minlen = (l1 < l2) ? l1 : l2;
+	cmp = memcmp(key1, key2, minlen);
+	if (cmp == 0) return (l1 < l2) ? -1 : (l1 > l2);
+	return cmp;
+}
+
+/* Bytes in front of the value of an entry whose engine header, links
+ * included, takes hdr bytes. */
+size_t index_entry_prefix(size_t hdr, size_t klen)
+{
+	return hdr + sdsEmbedSize(klen);
+}
+
+/* Fill an entry allocated with at least index_entry_prefix(hdr, klen) +
+ * vcap bytes. */
+void index_entry_init(index_entry *e, size_t hdr, const char *key, size_t klen,
+		const char *val, size_t vlen, size_t vcap)
+{
+	e->koff = hdr + sdsEmbedSize(klen) - klen - 1;
+	e->flags = 0;
+	sdsEmbed((char *)e + hdr, key, klen);
+	e->vcap = vcap;
+	index_entry_set_val(e, val, vlen);
+}
+
+/* The caller makes sure vlen <= e->vcap. */
+void index_entry_set_val(index_entry *e, const char *val, size_t vlen)
+{
+	index_entry_free_val(e);
+	e->vlen = vlen;
+	if (vlen) {
+		memcpy(ENTRY_VAL_SLOT(e), val, vlen);
+	}
+}
+
+/* Free an owned value, engines call it before they free an entry. */
+void index_entry_free_val(index_entry *e)
+{
+	if (e->flags & ENTRY_VAL_OWNED) {
+		sdsfree(index_entry_owned_val(e));
+		e->flags &= ~ENTRY_VAL_OWNED;
+	}
+}
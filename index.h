@@ -0,0 +1,123 @@
+#ifndef __INDEX_H__
+#define __INDEX_H__
+
+#include "sds.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Ordered index interface. Every engine keeps its key/value pairs in
+ * entries, single allocations laid out as:
+ *
+ * [index_entry][engine links][key as an embedded sds][value bytes]
+ *
+ * The key keeps an sds header so the dict can hash, compare and borrow it
+ * like any other sds. The value is not null terminated, 'vcap' bytes are
+ * reserved for it so that a value can grow in place. Callers only see
+ * index_entry pointers, engines cast them to their own node types.
+ *
+ * A large value may instead be an sds handed over by the caller: the value
+ * bytes then hold the pointer to it and the entry frees it. Entries in a
+ * slab never own their value. */
+typedef struct index_entry {
+	uint32_t vlen;  /* value length */
+	uint32_t vcap;  /* bytes reserved for the value */
+	uint16_t koff;  /* offset of the embedded key from the entry */
+	uint8_t flags;
+} index_entry;
+
+#define ENTRY_VAL_OWNED (1<<0)  /* the value is an sds owned by the entry */
+
+#define ENTRY_KEY(e) ((sds)((char *)(e) + (e)->koff))
+#define ENTRY_VAL_SLOT(e) (ENTRY_KEY(e) + sdslen(ENTRY_KEY(e)) + 1)
+#define ENTRY_VAL(e) ((e)->flags & ENTRY_VAL_OWNED ? index_entry_owned_val(e) : ENTRY_VAL_SLOT(e))
+
+struct ordered_index;
+
+/* Position in an index. Engines keep their state in 'node' and 'pos'. */
+typedef struct index_iter {
+	struct ordered_index *idx;
+	void *node;
+	int pos;
+} index_iter;
+
+typedef struct index_type {
+	const char *name;
+	void *(*create)(void);
+	void (*release)(void *ptr);
+	/* optional: allocate entries from a slab, every key klen bytes and
+	 * every value vlen bytes */
+	int (*use_slab)(void *ptr, size_t klen, size_t vlen);
+	/* insert or overwrite, return the entry holding the pair */
+	index_entry *(*insert)(void *ptr, sds key, const char *val, size_t vlen);
+	/* set the value of an entry, the entry may move */
+	index_entry *(*update)(void *ptr, index_entry *e, const char *val, size_t vlen);
+	index_entry *(*lookup)(void *ptr, sds key);
+	int (*delete)(void *ptr, sds key);
+	unsigned long (*count)(void *ptr);
+	/* iteration, each returns the entry under the iterator or NULL */
+	index_entry *(*first)(void *ptr, index_iter *it);
+	index_entry *(*last)(void *ptr, index_iter *it);
+	index_entry *(*seek)(void *ptr, index_iter *it, sds key);
+	index_entry *(*next)(void *ptr, index_iter *it);
+	index_entry *(*prev)(void *ptr, index_iter *it);
+	/* optional: append engine specific ",field=value" pairs for show */
+	sds (*info)(void *ptr, sds s);
+	/* optional: number of keys < key, without it the index is walked */
+	unsigned long (*rank)(void *ptr, sds key);
+	/* lookup is cheap enough to serve point reads without the dict */
+	int point_lookup;
+	/* optional: for engines read by other threads than the writer, see
+	 * index_read_begin() */
+	void (*read_begin)(void *ptr);
+	void (*read_end)(void *ptr);
+} index_type;
+
+typedef struct ordered_index {
+	index_type *type;
+	void *ptr;
+} ordered_index;
+
+index_type *index_type_lookup(const char *name);
+ordered_index *index_create(index_type *type);
+void index_release(ordered_index *idx);
+int index_use_slab(ordered_index *idx, size_t klen, size_t vlen);
+index_entry *index_insert(ordered_index *idx, sds key, const char *val, size_t vlen);
+index_entry *index_update(ordered_index *idx, index_entry *e, const char *val, size_t vlen);
+index_entry *index_insert_owned(ordered_index *idx, sds key, sds val);
+index_entry *index_update_owned(ordered_index *idx, index_entry *e, sds val);
+index_entry *index_lookup(ordered_index *idx, sds key);
+int index_delete(ordered_index *idx, sds key);
+unsigned long index_count(ordered_index *idx);
+index_entry *index_min(ordered_index *idx);
+index_entry *index_max(ordered_index *idx);
+index_entry *index_first(ordered_index *idx, index_iter *it);
+index_entry *index_last(ordered_index *idx, index_iter *it);
+index_entry *index_seek(ordered_index *idx, index_iter *it, sds key);
+index_entry *index_seek_last(ordered_index *idx, index_iter *it, sds key);
+index_entry *index_next(index_iter *it);
+index_entry *index_prev(index_iter *it);
+unsigned long index_rank(ordered_index *idx, sds key);
+unsigned long index_count_range(ordered_index *idx, sds start, sds end);
+sds index_info(ordered_index *idx, sds s);
+void index_read_begin(ordered_index *idx);
+void index_read_end(ordered_index *idx);
+
+/* entry helpers shared by the engines */
+int index_key_compare(sds key1, sds key2);
+size_t index_entry_prefix(size_t hdr, size_t klen);
+void index_entry_init(index_entry *e, size_t hdr, const char *key, size_t klen,
+		const char *val, size_t vlen, size_t vcap);
+void index_entry_set_val(index_entry *e, const char *val, size_t vlen);
+void index_entry_free_val(index_entry *e);
+
+static inline sds index_entry_owned_val(index_entry *e)
+{
+	sds val;
+
+	/* the value slot is not aligned */
+	memcpy(&val, ENTRY_VAL_SLOT(e), sizeof(val));
+	return val;
+}
+
+#endif
@@ -0,0 +1,248 @@
+#include "db.h"
+#include "iothreads.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+/* Threaded I/O. The reads, parsing and writes of the clients are spread
+ * over io-threads threads, the main thread included, while the main thread
+ * waits for all of them. Commands still run in the main thread only, so
+ * nothing they touch needs a lock.
+ *
+ * beforeSleep() first hands the clients that became readable to the
+ * threads, which read them and parse the complete commands into c->cmdq,
+ * then runs the queued commands. The clients with pending replies are
+ * then handed over the same way. With few clients to write the threads
+ * are parked on their mutex and the main thread does all the I/O. */
+
+#define IO_THREADS_OP_READ 0
+#define IO_THREADS_OP_WRITE 1
+#define IO_THREADS_SPIN 1000000  /* checks of the pending count before parking */
+
+static pthread_t io_threads[IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+static unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+static list *io_threads_list[IO_THREADS_MAX_NUM];
+static int io_threads_op;
+static int io_threads_active;
+
+static unsigned long getIOPendingCount(int i)
+{
+	return __atomic_load_n(&io_threads_pending[i], __ATOMIC_ACQUIRE);
+}
+
+static void setIOPendingCount(int i, unsigned long count)
+{
+	__atomic_store_n(&io_threads_pending[i], count, __ATOMIC_RELEASE);
+}
+
+static void processIOThreadList(int id)
+{
+	listIter li;
+	listNode *ln;
+
+	listRewind(io_threads_list[id], &li);
+	while ((ln = listNext(&li))) {
+		client *c = listNodeValue(ln);
+
+		if (io_threads_op == IO_THREADS_OP_WRITE) {
+			if (writeClientReplies(c) == SERVER_ERR) c->flags |= CLIENT_CLOSE_ASAP;
+		} else {
+			ioThreadReadClient(c);
+		}
+	}
+}
+
+static void *IOThreadMain(void *myid)
+{
+	long id = (long)myid;
+
+	initThreadQueryBuffer();
+	while (1) {
+		int j;
+
+		for (j = 0; j < IO_THREADS_SPIN; j++) {
+			if (getIOPendingCount(id) != 0) break;
+			if (j % 1024 == 1023) sched_yield();
+		}
+
+		/* Parked as long as the main thread holds the mutex. */
+		if (getIOPendingCount(id) == 0) {
+			pthread_mutex_lock(&io_threads_mutex[id]);
+			pthread_mutex_unlock(&io_threads_mutex[id]);
+			continue;
+		}
+
+		processIOThreadList(id);
+		setIOPendingCount(id, 0);
+	}
+	return NULL;
+}
+
+/* Hand the lists to the threads, do list 0 here and wait for the rest. */
+static void runIOThreads(int op)
+{
+	int j, spins = 0;
+
+	io_threads_op = op;
+	for (j = 1; j < server.io_threads_num; j++) {
+		setIOPendingCount(j, listLength(io_threads_list[j]));
+	}
+	processIOThreadList(0);
+	for (j = 1; j < server.io_threads_num; j++) {
+		/* leave the core to the thread when there are more threads
+		 * than cores */
+		while (getIOPendingCount(j) != 0) {
+			if (++spins % 1024 == 0) sched_yield();
+		}
+	}
+	for (j = 0; j < server.io_threads_num; j++) {
+		list *l = io_threads_list[j];
+		while (listLength(l)) listDelNode(l, listFirst(l));
+	}
+}
+
+void initThreadedIO(void)
+{
+	long i;
+
+	io_threads_active = 0;
+	if (server.io_threads_num == 1) return;
+
+	zmalloc_enable_thread_safeness();
+	for (i = 0; i < server.io_threads_num; i++) {
+		io_threads_list[i] = listCreate();
+		if (i == 0) continue; /* Thread 0 is the main thread. */
+
+		/* Threads start parked, see startThreadedIO(). */
+		pthread_mutex_init(&io_threads_mutex[i], NULL);
+		setIOPendingCount(i, 0);
+		pthread_mutex_lock(&io_threads_mutex[i]);
+		if (pthread_create(&io_threads[i], NULL, IOThreadMain, (void *)i) != 0) {
+			server_log(LL_WARNING, "Fatal: Can't initialize IO thread.");
+			exit(1);
+		}
+	}
+}
+
+static void startThreadedIO(void)
+{
+	int j;
+
+	for (j = 1; j < server.io_threads_num; j++)
+		pthread_mutex_unlock(&io_threads_mutex[j]);
+	io_threads_active = 1;
+}
+
+static void stopThreadedIO(void)
+{
+	int j;
+
+	/* reads are handled before writes, none is waiting here */
+	assert(listLength(server.clients_pending_read) == 0);
+	for (j = 1; j < server.io_threads_num; j++)
+		pthread_mutex_lock(&io_threads_mutex[j]);
+	io_threads_active = 0;
+}
+
+/* Threads spinning for a few clients cost more than they save. Return 1 if
+ * the main thread should do the I/O alone. */
+static int stopThreadedIOIfNeeded(void)
+{
+	unsigned long pending = listLength(serverTL->clients_pending_write);
+
+	if (server.io_threads_num == 1) return 1;
+	if (pending < (unsigned long)server.io_threads_num*2) {
+		if (io_threads_active) stopThreadedIO();
+		return 1;
+	}
+	return 0;
+}
+
+/* Queue the read of c for the I/O threads when they are active. Return 1
+ * if the read was postponed. */
+int postponeClientRead(client *c)
+{
+	if (!io_threads_active) return 0;
+	if (!(c->flags & CLIENT_PENDING_READ)) {
+		c->flags |= CLIENT_PENDING_READ;
+		listAddNodeHead(server.clients_pending_read, c);
+	}
+	return 1;
+}
+
+/* Read and parse the clients queued by postponeClientRead() in the I/O
+ * threads, then run their commands. Return the number of clients. */
+int handleClientsWithPendingReadsUsingThreads(void)
+{
+	int processed = listLength(server.clients_pending_read), item_id = 0;
+	listIter li;
+	listNode *ln;
+
+	if (!io_threads_active || processed == 0) return 0;
+
+	listRewind(server.clients_pending_read, &li);
+	while ((ln = listNext(&li))) {
+		client *c = listNodeValue(ln);
+		listAddNodeTail(io_threads_list[item_id % server.io_threads_num], c);
+		item_id++;
+	}
+	runIOThreads(IO_THREADS_OP_READ);
+
+	while (listLength(server.clients_pending_read)) {
+		client *c;
+
+		ln = listFirst(server.clients_pending_read);
+		c = listNodeValue(ln);
+		c->flags &= ~CLIENT_PENDING_READ;
+		listDelNode(server.clients_pending_read, ln);
+
+		if (c->flags & CLIENT_CLOSE_ASAP) {
+			freeClient(c);
+			continue;
+		}
+		processParsedCommands(c);
+	}
+	return processed;
+}
+
+/* Write the pending replies, in the I/O threads when there are enough
+ * clients to keep them busy. Return the number of clients. */
+int handleClientsWithPendingWritesUsingThreads(void)
+{
+	int processed = listLength(serverTL->clients_pending_write), item_id = 0;
+	listIter li;
+	listNode *ln;
+
+	if (processed == 0) return 0;
+	if (stopThreadedIOIfNeeded()) {
+		handleClientsWithPendingWrites();
+		return processed;
+	}
+	if (!io_threads_active) startThreadedIO();
+
+	listRewind(serverTL->clients_pending_write, &li);
+	while ((ln = listNext(&li))) {
+		client *c = listNodeValue(ln);
+		c->flags &= ~CLIENT_PENDING_WRITE;
+		listAddNodeTail(io_threads_list[item_id % server.io_threads_num], c);
+		item_id++;
+	}
+	runIOThreads(IO_THREADS_OP_WRITE);
+
+	/* Reply references and write handlers are main thread business. */
+	while (listLength(serverTL->clients_pending_write)) {
+		client *c;
+
+		ln = listFirst(serverTL->clients_pending_write);
+		c = listNodeValue(ln);
+		listDelNode(serverTL->clients_pending_write, ln);
+
+		if (c->flags & CLIENT_CLOSE_ASAP) {
+			freeClient(c);
+			continue;
+		}
+		finishClientWrite(c, 0);
+	}
+	return processed;
+}
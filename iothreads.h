@@ -0,0 +1,13 @@
+#ifndef _IOTHREADS_H_
+#define _IOTHREADS_H_
+
+#include "db.h"
+
+#define IO_THREADS_MAX_NUM 128
+
+void initThreadedIO(void);
+int postponeClientRead(client *c);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+
+#endif
@@ -31,9 +31,11 @@ static void server_logRaw(int level, const char *msg)
     } else {
         int off; 
         struct timeval tv;
+        struct tm tm;
 
         gettimeofday(&tv, NULL);
-        off = strftime(buf,sizeof(buf),"%d %b %H:%M:%S.",localtime(&tv.tv_sec));
+        localtime_r(&tv.tv_sec,&tm);
+        off = strftime(buf,sizeof(buf),"%d %b %H:%M:%S.",&tm);
         snprintf(buf+off,sizeof(buf)-off,"%03d",(int)tv.tv_usec/1000);
         fprintf(fp,"%d:%s %c %s\n",
             (int)getpid(), buf,c[level],msg);
@@ -253,9 +253,12 @@ sds sdsjoinsds(sds *argv, int argc, const char *sep, size_t seplen);
 
 /* Low level functions exposed to the user API */
 sds sdsMakeRoomFor(sds s, size_t addlen);
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen);
 void sdsIncrLen(sds s, int incr);
 sds sdsRemoveFreeSpace(sds s);
 size_t sdsAllocSize(sds s);
+size_t sdsEmbedSize(size_t initlen);
+sds sdsEmbed(void *buf, const void *init, size_t initlen);
 void *sdsAllocPtr(sds s);
 
 /* Export the allocator used by SDS to the program using SDS.
@@ -0,0 +1,330 @@
+#include "db.h"
+#include "shard.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+
+/* Shards. With shards N the keys are split in N ranges at the shard-bounds
+ * keys, and each range belongs to a shard with its own thread, event loop,
+ * dict and index. Every shard listens on the port with SO_REUSEPORT, so
+ * the kernel spreads the clients among them.
+ *
+ * Nothing of a shard is shared: a command on a key of another shard is
+ * handed over as a job, and the reply comes back the same way. The jobs
+ * are pushed on a lock free stack per shard, an eventfd wakes the shard
+ * up when the stack was empty. Shard 0 runs in the main thread.
+ *
+ * The exception is an engine whose readers may run beside its writer, see
+ * index_read_begin(): get and mget then read the index of another shard
+ * in place, while that shard goes on writing. */
+
+/* Return the shard owning key: the last one whose first key is <= key. */
+int shardOfKey(sds key)
+{
+	int lo = 0, hi = server.shard_bounds_num;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (index_key_compare(server.shard_bounds[mid], key) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+static void shardNotify(dbShard *s)
+{
+	uint64_t one = 1;
+
+	if (write(s->notify_fd, &one, sizeof(one)) == -1) {
+		/* the counter is already non zero, the shard wakes up anyway */
+	}
+}
+
+static void shardPush(dbShard *s, shardJob *job)
+{
+	shardJob *head = __atomic_load_n(&s->queue, __ATOMIC_RELAXED);
+
+	do {
+		job->next = head;
+	} while (!__atomic_compare_exchange_n(&s->queue, &head, job, 1,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	/* the shard drains the whole stack once woken up */
+	if (head == NULL) shardNotify(s);
+}
+
+static void shardQueueHandler(aeEventLoop *el, int fd, void *privdata, int mask)
+{
+	shardJob *jobs, *job, *fifo = NULL;
+	uint64_t count;
+	UNUSED(privdata);
+	UNUSED(mask);
+
+	if (read(fd, &count, sizeof(count)) == -1) {
+		/* nothing to reset, the stack is checked anyway */
+	}
+	if (__atomic_load_n(&serverTL->stop, __ATOMIC_ACQUIRE)) {
+		aeStop(el);
+		return;
+	}
+	if (serverTL->id == 0 && server.shutdown_asap) {
+		server_log(LL_WARNING, "tadpole is now ready to exit, bye bye...");
+		exit(0);
+	}
+
+	/* the stack is newest first, run the jobs in the order of pushes */
+	jobs = __atomic_exchange_n(&serverTL->queue, NULL, __ATOMIC_ACQUIRE);
+	while (jobs) {
+		job = jobs;
+		jobs = job->next;
+		job->next = fifo;
+		fifo = job;
+	}
+	while (fifo) {
+		job = fifo;
+		fifo = job->next;
+		shardRunJob(job);
+	}
+}
+
+/* Create the queue of s, and the client running the commands of other
+ * shards' clients. */
+void initShardQueue(dbShard *s)
+{
+	s->queue = NULL;
+	s->stop = 0;
+	s->notify_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (s->notify_fd == -1) {
+		server_log(LL_WARNING, "Creating the eventfd of shard %d: %s",
+				s->id, strerror(errno));
+		exit(1);
+	}
+	if (aeCreateFileEvent(s->el, s->notify_fd, AE_READABLE,
+				shardQueueHandler, NULL) == AE_ERR) {
+		server_panic("Unrecoverable error creating shard file event.");
+	}
+	s->proxy = createClient(-1, CLIENT_SHARD_PROXY);
+}
+
+static void *shardMain(void *arg)
+{
+	dbShard *s = arg;
+	sigset_t set;
+
+	/* signals go to the main thread, which stops the shards */
+	sigfillset(&set);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	serverTL = s;
+	initThreadQueryBuffer();
+	aeMain(s->el);
+	return NULL;
+}
+
+void startShards(void)
+{
+	int j;
+
+	if (server.shard_num == 1) return;
+
+	zmalloc_enable_thread_safeness();
+	for (j = 1; j < server.shard_num; j++) {
+		if (pthread_create(&server.shards[j].thread, NULL, shardMain,
+					&server.shards[j]) != 0) {
+			server_log(LL_WARNING, "Fatal: Can't start shard %d.", j);
+			exit(1);
+		}
+	}
+	server_log(LL_NOTICE, "%d shards started", server.shard_num);
+}
+
+/* Called at exit by the main thread: the shards are joined before the data
+ * file is written. */
+void stopShards(void)
+{
+	int j;
+
+	if (server.shard_num == 1 || serverTL != &server.shards[0]) return;
+
+	for (j = 1; j < server.shard_num; j++) {
+		__atomic_store_n(&server.shards[j].stop, 1, __ATOMIC_RELEASE);
+		shardNotify(&server.shards[j]);
+	}
+	for (j = 1; j < server.shard_num; j++) {
+		pthread_join(server.shards[j].thread, NULL);
+	}
+}
+
+/* Have the main thread exit. Safe in a signal handler. */
+void shutdownShards(void)
+{
+	server.shutdown_asap = 1;
+	shardNotify(&server.shards[0]);
+}
+
+/* Start a job for c, see shardJob. */
+shardJob *shardCreateJob(client *c, int first, int last,
+		shardJobProc *proc, shardJobProc *done)
+{
+	shardJob *job = zmalloc(sizeof(*job));
+
+	job->next = NULL;
+	job->c = c;
+	job->origin = serverTL->id;
+	job->first = first;
+	job->shard = first;
+	job->last = last;
+	job->step = first <= last ? 1 : -1;
+	job->finished = 0;
+	job->yield = 0;
+	job->rewind = 0;
+	job->deliver = 0;
+	job->proc = proc;
+	job->done = done;
+	job->reply = NULL;
+	job->count = 0;
+	job->privdata = NULL;
+	return job;
+}
+
+static void shardFinishJob(shardJob *job)
+{
+	client *c = job->c;
+
+	job->done(job);
+	sdsfree(job->reply);
+	zfree(job);
+	if (c->flags & CLIENT_SHARD_WAIT) unblockShardClient(c);
+}
+
+/* Park a job that yielded until the next iteration of the event loop,
+ * which does not sleep meanwhile unless the job waits for it to wake. */
+static void shardYieldJob(shardJob *job)
+{
+	if (serverTL->id == job->origin) job->c->flags |= CLIENT_SHARD_WAIT;
+	listAddNodeTail(serverTL->jobs_yielded, job);
+	if (job->yield == SHARD_YIELD_NOW) aeSetDontWait(serverTL->el, 1);
+}
+
+/* Run job on this shard and the next ones as long as they are this one,
+ * then hand it over. A job that never leaves the shard of its client nor
+ * yields finishes before returning.
+ *
+ * A job delivering runs proc on the origin, then goes back to its shard. */
+void shardRunJob(shardJob *job)
+{
+	while (!job->finished) {
+		int delivering = job->deliver;
+
+		if ((delivering ? job->origin : job->shard) != serverTL->id) break;
+		job->proc(job);
+		if (job->yield) {
+			shardYieldJob(job);
+			return;
+		}
+		if (delivering) {
+			job->deliver = 0;
+		} else if (job->deliver) {
+			continue;
+		} else if (job->rewind) {
+			job->rewind = 0;
+			job->shard = job->first;
+		} else if (job->shard == job->last) {
+			job->finished = 1;
+		} else {
+			job->shard += job->step;
+		}
+	}
+
+	if (!job->finished) {
+		if (serverTL->id == job->origin) job->c->flags |= CLIENT_SHARD_WAIT;
+		shardPush(&server.shards[job->deliver ? job->origin : job->shard], job);
+	} else if (serverTL->id != job->origin) {
+		shardPush(&server.shards[job->origin], job);
+	} else {
+		shardFinishJob(job);
+	}
+}
+
+/* Called before the event loop sleeps: give the jobs that yielded their
+ * next slice. Those yielding again wait for the next call. */
+void shardResumeJobs(void)
+{
+	list *jobs = serverTL->jobs_yielded;
+	unsigned long n = listLength(jobs);
+	int now = 0;
+	listIter li;
+	listNode *ln;
+
+	while (n--) {
+		shardJob *job;
+
+		ln = listFirst(jobs);
+		job = listNodeValue(ln);
+		listDelNode(jobs, ln);
+		job->yield = 0;
+		shardRunJob(job);
+	}
+
+	listRewind(jobs, &li);
+	while ((ln = listNext(&li))) {
+		shardJob *job = listNodeValue(ln);
+		if (job->yield == SHARD_YIELD_NOW) now = 1;
+	}
+	aeSetDontWait(serverTL->el, now);
+}
+
+/* Move the replies of the proxy client into an sds. They are never
+ * references, see addReplyBulkRef(). */
+static sds takeProxyReply(client *p)
+{
+	sds reply = sdsnewlen(p->buf, p->bufpos);
+
+	while (listLength(p->reply)) {
+		listNode *ln = listFirst(p->reply);
+		clientReplyBlock *o = listNodeValue(ln);
+
+		reply = sdscatlen(reply, o->buf, o->used);
+		listDelNode(p->reply, ln);
+	}
+	p->bufpos = 0;
+	p->reply_bytes = 0;
+	return reply;
+}
+
+static void callOnProxy(shardJob *job)
+{
+	client *p = serverTL->proxy;
+
+	p->argc = job->c->argc;
+	p->argv = job->c->argv;
+	p->cmd = job->c->cmd;
+	call(p);
+	p->argc = 0;
+	p->argv = NULL;
+	p->cmd = NULL;
+	job->reply = takeProxyReply(p);
+}
+
+static void replyFromProxy(shardJob *job)
+{
+	addReplyString(job->c, job->reply, sdslen(job->reply));
+}
+
+/* Run the command of c on the given shard, which owns its key. */
+void shardRunCommand(client *c, int shard)
+{
+	shardRunJob(shardCreateJob(c, shard, shard, callOnProxy, replyFromProxy));
+}
+
+/* Whether the reads of keys owned by other shards are done in place, with
+ * index_read_begin(), rather than handed over as jobs. */
+int shardReadsInPlace(void)
+{
+	return server.shard_num > 1 && server.index_engine->read_begin != NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef _SHARD_H_
+#define _SHARD_H_
+
+#include "db.h"
+
+/* A command that needs the keys of other shards is run as a job. The job
+ * visits the shards from 'shard' to 'last', in key order or in reverse,
+ * calling proc in the thread of each. It then goes back to the shard of
+ * the client, where done adds the reply. The client waits meanwhile, so
+ * its argv can be read by every shard.
+ *
+ * A long proc may yield: it is then called again on the same shard in the
+ * next iteration of the event loop, which serves other clients in between,
+ * or once the loop had something to do if it waits for a client. A proc
+ * may also rewind the job to its first shard, or have the shard of the
+ * client deliver what it gathered before it goes on. */
+typedef struct shardJob shardJob;
+typedef void shardJobProc(shardJob *job);
+
+struct shardJob {
+	shardJob *next;             /* link in the queue of a shard */
+	client *c;
+	int origin;                 /* shard of c */
+	int first;                  /* shard the job started on */
+	int shard, last, step;      /* shard to run on next, last one, +1 or -1 */
+	int finished;               /* set by proc to skip the remaining shards */
+	int yield;                  /* set by proc to run again later, see below */
+	int rewind;                 /* set by proc to go on from the first shard */
+	int deliver;                /* set by proc to visit the origin first */
+	shardJobProc *proc;
+	shardJobProc *done;
+	sds reply;                  /* built along the way, freed with the job */
+	long long count;
+	void *privdata;             /* command state, done frees it */
+};
+
+#define SHARD_YIELD_NOW 1    /* run again on the next tick */
+#define SHARD_YIELD_IDLE 2   /* run again once the loop wakes up */
+
+void initShardQueue(dbShard *s);
+void startShards(void);
+void stopShards(void);
+void shutdownShards(void);
+int shardOfKey(sds key);
+shardJob *shardCreateJob(client *c, int first, int last,
+		shardJobProc *proc, shardJobProc *done);
+void shardRunJob(shardJob *job);
+void shardResumeJobs(void);
+void shardRunCommand(client *c, int shard);
+int shardReadsInPlace(void);
+
+#endif
@@ -3,19 +3,46 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <malloc.h>
 
-#define MAX_LEVEL 16
+#define MAX_LEVEL SKIPLIST_MAX_LEVEL
 
-sl_node *create_skiplist_node(int level, sds key, sds val)
+/* bytes of a node in front of its key */
+static size_t skiplist_node_hdr(int level)
 {
-	/* flexible array to index level */
-	sl_node *node = (sl_node *)malloc(sizeof(sl_node) + level * sizeof(void *));
-	if (!node) {
-		return NULL;
+	return sizeof(sl_node) + level * sizeof(sl_link);
+}
+
+sl_node *create_skiplist_node(skiplist *sl, int level, const char *key,
+		size_t klen, const char *val, size_t vlen)
+{
+	size_t hdr = skiplist_node_hdr(level);
+	size_t prefix = index_entry_prefix(hdr, klen);
+	size_t vcap;
+	sl_node *node;
+
+	/* level pointers, key and value share a single allocation */
+	if (sl && sl->arena) {
+		size_t slot = sl->arena->classes[level - 1].size;
+		if (prefix + vlen > slot) {
+			return NULL;
+		}
+		node = (sl_node *)slab_alloc(sl->arena, level - 1);
+		if (!node) {
+			return NULL;
+		}
+		vcap = slot - prefix;
+	} else {
+		node = (sl_node *)malloc(prefix + vlen);
+		if (!node) {
+			return NULL;
+		}
+		/* whatever the allocator rounded up is free room for the value */
+		vcap = malloc_usable_size(node) - prefix;
 	}
 
-	node->key = key;
-	node->val = val;
+	node->level = level;
+	index_entry_init(&node->entry, hdr, key, klen, val, vlen, vcap);
 	return node;
 }
 
@@ -29,15 +56,71 @@ skiplist *create_skiplist()
 
 	sl->level = 1;
 	sl->length = 0;
-	sl->head = create_skiplist_node(MAX_LEVEL, NULL, NULL);
+	sl->tail = NULL;
+	sl->arena = NULL;
+	sl->finger_node = NULL;
+	/* the head is never freed, keep it out of the arena */
+	sl->head = create_skiplist_node(NULL, MAX_LEVEL, NULL, 0, NULL, 0);
 	int i;
 	for (i = 0; i < MAX_LEVEL; i++) {
-		sl->head->next[i] = 0;
+		sl->head->lvl[i].next = 0;
+		sl->head->lvl[i].span = 0;
 	}
+	sl->head->backward = NULL;
 
 	return sl;
 }
 
+static void free_skiplist_node(skiplist *sl, sl_node *node)
+{
+	if (sl->arena) {
+		slab_free(sl->arena, node->level - 1, node);
+	} else {
+		index_entry_free_val(&node->entry);
+		free(node);
+	}
+
+	return;
+}
+
+void release_skiplist(skiplist *sl)
+{
+	sl_node *node = sl->head->lvl[0].next, *next;
+
+	if (sl->arena) {
+		/* nodes live in the arena pages */
+		slab_release(sl->arena);
+	} else {
+		while (node) {
+			next = node->lvl[0].next;
+			index_entry_free_val(&node->entry);
+			free(node);
+			node = next;
+		}
+	}
+	free(sl->head);
+	free(sl);
+}
+
+/* Allocate the nodes of sl from a slab arena with one class per level,
+ * sized for keys of klen bytes and values of vlen bytes. Nodes that do not
+ * fit can not be inserted. Must be called while sl is empty. */
+int skiplist_use_slab(skiplist *sl, size_t klen, size_t vlen)
+{
+	size_t sizes[MAX_LEVEL];
+	int i;
+
+	if (sl->length != 0 || sl->arena) {
+		return -1;
+	}
+
+	for (i = 0; i < MAX_LEVEL; i++) {
+		sizes[i] = index_entry_prefix(skiplist_node_hdr(i + 1), klen) + vlen;
+	}
+	sl->arena = slab_create(sizes, MAX_LEVEL);
+	return sl->arena ? 0 : -1;
+}
+
 static int gen_random_level()
 {
 	int level = 1;
@@ -48,73 +131,144 @@ static int gen_random_level()
 	return (level > MAX_LEVEL) ? MAX_LEVEL : level;
 }
 
-int slKeyCompare(sds key1, sds key2)
-{
-    int l1,l2;
-
-    l1 = sdslen((sds)key1);
-    l2 = sdslen((sds)key2);
-    if (l1 != l2) return 0;
-    return memcmp(key1, key2, l1);
-}
-
 
-int insert_skiplist(skiplist *sl, sds key, sds val)
+/* Insert key/val and return the node holding them, so that callers can
+ * index the node directly. If the key is already present its value is
+ * replaced as update_skiplist() does. NULL is returned on out of memory. */
+sl_node *insert_skiplist(skiplist *sl, sds key, const char *val, size_t vlen)
 {
 	sl_node *update[MAX_LEVEL];
+	unsigned long rank[MAX_LEVEL];
 	sl_node *x = sl->head, *q = NULL;
-	int i;
+	int i, finger;
 
-	/* search from high to low to find target level */
+	/* ascending keys resume from the finger */
+	finger = sl->finger_node &&
+		index_key_compare(SL_NODE_KEY(sl->finger_node), key) < 0;
+
+	/* search from high to low to find target level, rank[i] is the rank
+	 * of update[i] */
 	for (i = sl->level - 1; i >= 0; i--) {
-		while ((q = x->next[i]) && (slKeyCompare(q->key, key) < 0)) {
+		rank[i] = (i == sl->level - 1) ? 0 : rank[i + 1];
+		/* the finger node at this level is smaller than key, jump to it
+		 * when it is further than where we are */
+		if (finger && i < sl->finger_level && sl->finger_rank[i] > rank[i]) {
+			x = sl->finger[i];
+			rank[i] = sl->finger_rank[i];
+		}
+		while ((q = x->lvl[i].next) && (index_key_compare(SL_NODE_KEY(q), key) < 0)) {
+			rank[i] += x->lvl[i].span;
 			x = q;
 		}
 		update[i] = x;
 	}
 
-	if (q && slKeyCompare(q->key, key) == 0) {
-		sdsfree(q->val);
-		q->val = val;
-		sl->length++;
-		return 0;
+	if (q && index_key_compare(SL_NODE_KEY(q), key) == 0) {
+		return update_skiplist(sl, q, val, vlen);
 	}
 
 	/* generate a random level */
 	int target_level = gen_random_level();
 	if (target_level > sl->level) {
 		for (i = sl->level; i < target_level; i++) {
+			rank[i] = 0;
 			update[i] = sl->head;
+			update[i]->lvl[i].span = sl->length;
 		}
 		sl->level = target_level;
 	}
 
-	q = create_skiplist_node(target_level, sdsdup(key), sdsdup(val));
+	q = create_skiplist_node(sl, target_level, key, sdslen(key), val, vlen);
 	if (!q) {
-		return -1;
+		return NULL;
 	}
 
 	/* update current list */
 	for (i = target_level - 1; i >= 0; i--) {
-		q->next[i] = update[i]->next[i];
-		update[i]->next[i] = q;
+		q->lvl[i].next = update[i]->lvl[i].next;
+		update[i]->lvl[i].next = q;
+		q->lvl[i].span = update[i]->lvl[i].span - (rank[0] - rank[i]);
+		update[i]->lvl[i].span = (rank[0] - rank[i]) + 1;
+	}
+	/* levels above the node now span one more node */
+	for (i = target_level; i < sl->level; i++) {
+		update[i]->lvl[i].span++;
+	}
+
+	/* the node itself is the closest start for the next greater key */
+	for (i = 0; i < sl->level; i++) {
+		if (i < target_level) {
+			sl->finger[i] = q;
+			sl->finger_rank[i] = rank[0] + 1;
+		} else {
+			sl->finger[i] = update[i];
+			sl->finger_rank[i] = rank[i];
+		}
+	}
+	sl->finger_level = sl->level;
+	sl->finger_node = q;
+	q->backward = (update[0] == sl->head) ? NULL : update[0];
+	if (q->lvl[0].next) {
+		q->lvl[0].next->backward = q;
+	} else {
+		sl->tail = q;
 	}
 
 	sl->length++;
-	return 0;
+	return q;
 }
 
-static void free_skiplist_node(sl_node *node)
+/* Set the value of a node linked in sl. The value is rewritten in place
+ * when it fits, otherwise the node is reallocated and its predecessors are
+ * relinked. Return the node, which may have moved: any pointer to the old
+ * node or to its key must be refreshed. On out of memory NULL is returned
+ * and the old node is left untouched. */
+sl_node *update_skiplist(skiplist *sl, sl_node *node, const char *val, size_t vlen)
 {
-	if (!node) {
-		return;
+	sl_node *update[MAX_LEVEL];
+	sl_node *x = sl->head, *q = NULL;
+	sds key = SL_NODE_KEY(node);
+	size_t prefix;
+	int i;
+
+	if (vlen <= node->entry.vcap) {
+		index_entry_set_val(&node->entry, val, vlen);
+		return node;
 	}
 
-	sdsfree(node->key);
-	sdsfree(node->val);
-	free(node);
+	/* slab slots have a fixed size */
+	if (sl->arena) {
+		return NULL;
+	}
 
-	return;
+	/* the node may be on the finger */
+	sl->finger_node = NULL;
+
+	/* collect the predecessors before the node moves */
+	for (i = node->level - 1; i >= 0; i--) {
+		while ((q = x->lvl[i].next) && q != node && index_key_compare(SL_NODE_KEY(q), key) < 0) {
+			x = q;
+		}
+		update[i] = x;
+	}
+
+	prefix = index_entry_prefix(skiplist_node_hdr(node->level), sdslen(key));
+	q = (sl_node *)realloc(node, prefix + vlen);
+	if (!q) {
+		return NULL;
+	}
+
+	for (i = q->level - 1; i >= 0; i--) {
+		update[i]->lvl[i].next = q;
+	}
+	if (q->lvl[0].next) {
+		q->lvl[0].next->backward = q;
+	} else {
+		sl->tail = q;
+	}
+	q->entry.vcap = malloc_usable_size(q) - prefix;
+	index_entry_set_val(&q->entry, val, vlen);
+	return q;
 }
 
 int delete_skiplist(skiplist *sl, sds key)
@@ -124,81 +278,208 @@ int delete_skiplist(skiplist *sl, sds key)
 	int i;
 
 	for (i = sl->level - 1; i >= 0; i--) {
-		while ((q = p->next[i]) && slKeyCompare(q->key, key) < 0) {
+		while ((q = p->lvl[i].next) && index_key_compare(SL_NODE_KEY(q), key) < 0) {
 			p = q;
 		}
 		update[i] = p;
 	}
 
-	if (!q|| slKeyCompare(q->key, key) != 0) {
+	if (!q|| index_key_compare(SL_NODE_KEY(q), key) != 0) {
 		return -1;
 	}
 
 	for (i = sl->level - 1; i >= 0; i--) {
-		if (update[i]->next[i] == q) {
-			update[i]->next[i] = q->next[i];
-			if (sl->head->next[i] == NULL) {
-				sl->level--;
-			}
+		if (update[i]->lvl[i].next == q) {
+			update[i]->lvl[i].span += q->lvl[i].span - 1;
+			update[i]->lvl[i].next = q->lvl[i].next;
+		} else {
+			update[i]->lvl[i].span--;
 		}
 	}
+	if (q->lvl[0].next) {
+		q->lvl[0].next->backward = q->backward;
+	} else {
+		sl->tail = q->backward;
+	}
+	sl->finger_node = NULL;
+	while (sl->level > 1 && sl->head->lvl[sl->level - 1].next == NULL) {
+		sl->level--;
+	}
 
-	free_skiplist_node(q);
+	free_skiplist_node(sl, q);
 	sl->length--;
 	return 0;
 }
 
-sds search_skiplist(skiplist *sl, sds key)
+sl_node *search_skiplist(skiplist *sl, sds key)
 {
     sl_node *q = NULL, *p=sl->head;
     int i;
     for (i = sl->level - 1; i >= 0; i--) {
-        while ((q = p->next[i]) && slKeyCompare(q->key, key) < 0) {
+        while ((q = p->lvl[i].next) && index_key_compare(SL_NODE_KEY(q), key) < 0) {
             p = q;
         }
 
-        if (q && slKeyCompare(key, q->key) == 0)
-            return q->val;
-    }   
+        if (q && index_key_compare(key, SL_NODE_KEY(q)) == 0)
+            return q;
+    }
     return NULL;
 }
 
-int replace_skiplist(skiplist *sl, sds key, sds newVal)
+/* Return the first node whose key is >= key, NULL if there is none. */
+sl_node *seek_skiplist(skiplist *sl, sds key)
 {
-    sl_node *q = NULL, *p=sl->head;
-    int i;
-    for(i = sl->level - 1; i >= 0; i--) {
-        while((q = p->next[i]) && slKeyCompare(q->key, key) < 0) {
-            p = q;
-        }
+	sl_node *q = NULL, *p = sl->head;
+	int i;
 
-        if (q && slKeyCompare(key, q->key) == 0) {
-            sdsfree(q->val);
-			q->val = sdsdup(newVal);
-			return 0;
+	for (i = sl->level - 1; i >= 0; i--) {
+		while ((q = p->lvl[i].next) && index_key_compare(SL_NODE_KEY(q), key) < 0) {
+			p = q;
 		}
-    }
-    return -1;
+	}
+	return q;
 }
 
-sds find_max_skiplist(skiplist *sl)
+/* Return the number of nodes whose key is < key. */
+unsigned long rank_skiplist(skiplist *sl, sds key)
 {
-	int i = sl->level- 1;
-	sl_node *node = sl->head->next[i];
+	sl_node *q = NULL, *p = sl->head;
+	unsigned long rank = 0;
+	int i;
 
-#if 0
-	for (; i >= 0; i--) {
-		while (node->next[i]) {
-			node = node->next[i];
+	for (i = sl->level - 1; i >= 0; i--) {
+		while ((q = p->lvl[i].next) && index_key_compare(SL_NODE_KEY(q), key) < 0) {
+			rank += p->lvl[i].span;
+			p = q;
 		}
-		node = node->next[i-1];
 	}
-#else
-	while (node->next[0]) {
-		node = node->next[0];
+	return rank;
+}
+
+/* Return the node in front of node, NULL if node is the first one. */
+sl_node *prev_skiplist(skiplist *sl, sl_node *node)
+{
+	(void)sl;
+	return node->backward;
+}
+
+/* Return the node with the greatest key, NULL if sl is empty. */
+sl_node *last_skiplist(skiplist *sl)
+{
+	return sl->tail;
+}
+
+/*-----------------------------------------------------------------------------
+ * Ordered index engine
+ *----------------------------------------------------------------------------*/
+static void *sl_create(void)
+{
+	return create_skiplist();
+}
+
+static void sl_release(void *ptr)
+{
+	release_skiplist(ptr);
+}
+
+static int sl_use_slab(void *ptr, size_t klen, size_t vlen)
+{
+	return skiplist_use_slab(ptr, klen, vlen);
+}
+
+static index_entry *sl_insert(void *ptr, sds key, const char *val, size_t vlen)
+{
+	return (index_entry *)insert_skiplist(ptr, key, val, vlen);
+}
+
+static index_entry *sl_update(void *ptr, index_entry *e, const char *val, size_t vlen)
+{
+	return (index_entry *)update_skiplist(ptr, (sl_node *)e, val, vlen);
+}
+
+static index_entry *sl_lookup(void *ptr, sds key)
+{
+	return (index_entry *)search_skiplist(ptr, key);
+}
+
+static int sl_delete(void *ptr, sds key)
+{
+	return delete_skiplist(ptr, key);
+}
+
+static unsigned long sl_count(void *ptr)
+{
+	return ((skiplist *)ptr)->length;
+}
+
+static index_entry *sl_first(void *ptr, index_iter *it)
+{
+	it->node = ((skiplist *)ptr)->head->lvl[0].next;
+	return it->node;
+}
+
+static index_entry *sl_last(void *ptr, index_iter *it)
+{
+	it->node = last_skiplist(ptr);
+	return it->node;
+}
+
+static index_entry *sl_seek(void *ptr, index_iter *it, sds key)
+{
+	it->node = seek_skiplist(ptr, key);
+	return it->node;
+}
+
+static index_entry *sl_next(void *ptr, index_iter *it)
+{
+	(void)ptr;
+	if (it->node) {
+		it->node = ((sl_node *)it->node)->lvl[0].next;
+	}
+	return it->node;
+}
+
+static index_entry *sl_prev(void *ptr, index_iter *it)
+{
+	if (it->node) {
+		it->node = prev_skiplist(ptr, it->node);
 	}
+	return it->node;
+}
+
+static unsigned long sl_rank(void *ptr, sds key)
+{
+	return rank_skiplist(ptr, key);
+}
 
-#endif
+static sds sl_info(void *ptr, sds s)
+{
+	skiplist *sl = ptr;
 
-	return node->key;
+	/* fixed-length mode: memory of the node slab arena */
+	if (sl->arena) {
+		s = sdscatfmt(s, ",slab_used=%U,slab_allocated=%U",
+			(unsigned long long)slab_used_bytes(sl->arena),
+			(unsigned long long)slab_allocated_bytes(sl->arena));
+	}
+	return s;
 }
+
+index_type skiplistIndexType = {
+	"skiplist",
+	sl_create,
+	sl_release,
+	sl_use_slab,
+	sl_insert,
+	sl_update,
+	sl_lookup,
+	sl_delete,
+	sl_count,
+	sl_first,
+	sl_last,
+	sl_seek,
+	sl_next,
+	sl_prev,
+	sl_info,
+	sl_rank
+};
@@ -1,26 +1,61 @@
 #ifndef __SKIPLIST_H__
 #define __SKIPLIST_H__
 #include "sds.h"
+#include "slab.h"
+#include "index.h"
+#include <stdint.h>
 
 
+/* A link of one level. The span is the number of level 0 steps to the
+ * next node, or to the end of the list when there is none, so ranks add up
+ * along a search path. */
+typedef struct skiplist_link {
+	struct skiplist_node *next;
+	unsigned long span;
+} sl_link;
+
+/* A node is a single index entry: the level links are the engine links
+ * that sit between the entry header and the embedded key. */
 typedef struct skiplist_node {
-	char *key;
-	char *val;
-	/* flexible array to store level nodes */
-	struct skiplist_node *next[0];
+	index_entry entry;  /* must be first, callers see nodes as entries */
+	uint8_t level;
+	struct skiplist_node *backward;  /* level 0 predecessor, NULL for the first node */
+	/* flexible array to store level links */
+	sl_link lvl[];
 }sl_node;
 
+#define SL_NODE_KEY(n) ENTRY_KEY(&(n)->entry)
+#define SL_NODE_VAL(n) ENTRY_VAL(&(n)->entry)
+
+#define SKIPLIST_MAX_LEVEL 16
+
 typedef struct skiplist {
 	int level;
-	int length;
-	struct skiplist_node *head, *tail;
+	unsigned long length;
+	struct skiplist_node *head, *tail;  /* tail is NULL while sl is empty */
+	slab_arena *arena;  /* node slots by level, NULL to use malloc */
+	/* Finger: the last inserted node with its predecessor and their rank at
+	 * each level. An insert of a greater key starts its search there, so
+	 * ascending inserts skip most of the descent. Deletes and moved nodes
+	 * drop it. */
+	struct skiplist_node *finger_node;
+	struct skiplist_node *finger[SKIPLIST_MAX_LEVEL];
+	unsigned long finger_rank[SKIPLIST_MAX_LEVEL];
+	int finger_level;
 }skiplist;
 
+extern index_type skiplistIndexType;
 
 skiplist *create_skiplist();
-sds search_skiplist(skiplist *sl, sds key);
-int insert_skiplist(skiplist *sl, sds key, sds val);
+void release_skiplist(skiplist *sl);
+int skiplist_use_slab(skiplist *sl, size_t klen, size_t vlen);
+sl_node *search_skiplist(skiplist *sl, sds key);
+sl_node *seek_skiplist(skiplist *sl, sds key);
+sl_node *prev_skiplist(skiplist *sl, sl_node *node);
+sl_node *last_skiplist(skiplist *sl);
+unsigned long rank_skiplist(skiplist *sl, sds key);
+sl_node *insert_skiplist(skiplist *sl, sds key, const char *val, size_t vlen);
+sl_node *update_skiplist(skiplist *sl, sl_node *node, const char *val, size_t vlen);
 int delete_skiplist(skiplist *sl, sds key);
-sds find_max_skiplist(skiplist *sl);
 
 #endif
@@ -0,0 +1,135 @@
+#include "slab.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Page layout: the link to the next page, then slots back to back. */
+#define SLAB_PAGE_HDR sizeof(void *)
+#define SLAB_ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+/* Create an arena with one class per entry of sizes. Slots are pointer
+ * aligned, so the usable size of a slot may be larger than requested. */
+slab_arena *slab_create(const size_t *sizes, int nclass)
+{
+	slab_arena *arena;
+	int i;
+
+	arena = (slab_arena *)malloc(sizeof(slab_arena) + nclass * sizeof(slab_class));
+	if (!arena) {
+		return NULL;
+	}
+
+	arena->nclass = nclass;
+	arena->pages = NULL;
+	for (i = 0; i < nclass; i++) {
+		slab_class *sc = &arena->classes[i];
+
+		sc->size = SLAB_ALIGN(sizes[i] < sizeof(void *) ? sizeof(void *) : sizes[i]);
+		sc->free = NULL;
+		sc->cur = NULL;
+		sc->left = 0;
+		sc->used = 0;
+		sc->pages = 0;
+	}
+
+	return arena;
+}
+
+void slab_release(slab_arena *arena)
+{
+	void *page, *next;
+
+	if (!arena) {
+		return;
+	}
+
+	for (page = arena->pages; page; page = next) {
+		memcpy(&next, page, sizeof(void *));
+		free(page);
+	}
+	free(arena);
+}
+
+/* A page holds as many slots as fit in SLAB_PAGE_SIZE, at least one. */
+static size_t slab_page_slots(slab_class *sc)
+{
+	size_t n = (SLAB_PAGE_SIZE - SLAB_PAGE_HDR) / sc->size;
+
+	return n ? n : 1;
+}
+
+static int slab_grow(slab_arena *arena, slab_class *sc)
+{
+	size_t nslots = slab_page_slots(sc);
+	char *page = (char *)malloc(SLAB_PAGE_HDR + nslots * sc->size);
+
+	if (!page) {
+		return -1;
+	}
+
+	memcpy(page, &arena->pages, sizeof(void *));
+	arena->pages = page;
+	sc->cur = page + SLAB_PAGE_HDR;
+	sc->left = nslots;
+	sc->pages++;
+	return 0;
+}
+
+void *slab_alloc(slab_arena *arena, int cls)
+{
+	slab_class *sc = &arena->classes[cls];
+	void *slot;
+
+	/* recycle released slots first */
+	if (sc->free) {
+		slot = sc->free;
+		memcpy(&sc->free, slot, sizeof(void *));
+		sc->used++;
+		return slot;
+	}
+
+	if (sc->left == 0 && slab_grow(arena, sc) == -1) {
+		return NULL;
+	}
+
+	slot = sc->cur;
+	sc->cur += sc->size;
+	sc->left--;
+	sc->used++;
+	return slot;
+}
+
+void slab_free(slab_arena *arena, int cls, void *slot)
+{
+	slab_class *sc = &arena->classes[cls];
+
+	memcpy(slot, &sc->free, sizeof(void *));
+	sc->free = slot;
+	sc->used--;
+}
+
+/* Bytes of the slots currently handed out. */
+size_t slab_used_bytes(slab_arena *arena)
+{
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < arena->nclass; i++) {
+		total += arena->classes[i].used * arena->classes[i].size;
+	}
+	return total;
+}
+
+/* Bytes taken from the system for pages. */
+size_t slab_allocated_bytes(slab_arena *arena)
+{
+	size_t total = 0;
+	int i;
+
+	for (i = 0; i < arena->nclass; i++) {
+		slab_class *sc = &arena->classes[i];
+
+		total += sc->pages * (SLAB_PAGE_HDR + slab_page_slots(sc) * sc->size);
+	}
+	return total;
+}
@@ -0,0 +1,32 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+#define SLAB_PAGE_SIZE (64*1024)
+
+/* Slots of one size, carved from pages on demand. Freed slots are kept
+ * in a free list threaded through their first word. */
+typedef struct slab_class {
+	size_t size;            /* slot size */
+	void *free;             /* free list of released slots */
+	char *cur;              /* next never used slot of the current page */
+	size_t left;            /* never used slots left in the current page */
+	unsigned long used;     /* slots handed out */
+	unsigned long pages;
+} slab_class;
+
+typedef struct slab_arena {
+	int nclass;
+	void *pages;            /* every page, linked through their first word */
+	slab_class classes[];
+} slab_arena;
+
+slab_arena *slab_create(const size_t *sizes, int nclass);
+void slab_release(slab_arena *arena);
+void *slab_alloc(slab_arena *arena, int cls);
+void slab_free(slab_arena *arena, int cls, void *slot);
+size_t slab_used_bytes(slab_arena *arena);
+size_t slab_allocated_bytes(slab_arena *arena);
+
+#endif
@@ -0,0 +1,246 @@
+#include "db.h"
+#include "snapshot.h"
+#include "skiplist.h"
+
+#include <string.h>
+#include <limits.h>
+
+/* Snapshots. The write sequence only advances when a snapshot is taken, so
+ * writes read it rather than bump it: a write observing seq g comes after
+ * every snapshot numbered <= g, which see the value it saved, and before
+ * the later ones, numbered > g. Shards run their writes one at a time, so
+ * whatever shard a scan visits later, the writes it finds applied there
+ * without a saved version are older than the scan's snapshot.
+ *
+ * Writes only save versions while a snapshot is open, and at most one per
+ * key and sequence: a later write with the same seq is invisible to every
+ * snapshot that can still see the first. Each shard drops in its cron the
+ * versions older than the oldest open snapshot. */
+
+void initSnapshots(void)
+{
+	server.snapshot_seq = 0;
+	server.snapshots_open = 0;
+	server.snapshots = listCreate();
+	pthread_mutex_init(&server.snapshots_mutex, NULL);
+}
+
+/* Take a snapshot, snapshotClose() releases it. Any shard may take one. */
+snapshot *snapshotOpen(void)
+{
+	snapshot *s = zmalloc(sizeof(*s));
+
+	s->ctime = __atomic_load_n(&server.unixtime, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&server.snapshots_mutex);
+	/* writers must see it open before they can observe its sequence */
+	__atomic_add_fetch(&server.snapshots_open, 1, __ATOMIC_SEQ_CST);
+	s->seq = __atomic_add_fetch(&server.snapshot_seq, 1, __ATOMIC_SEQ_CST);
+	listAddNodeTail(server.snapshots, s);
+	pthread_mutex_unlock(&server.snapshots_mutex);
+	return s;
+}
+
+void snapshotClose(snapshot *s)
+{
+	pthread_mutex_lock(&server.snapshots_mutex);
+	listDelNode(server.snapshots, listSearchKey(server.snapshots, s));
+	__atomic_sub_fetch(&server.snapshots_open, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&server.snapshots_mutex);
+	zfree(s);
+}
+
+/* Sequence of the oldest open snapshot, ULLONG_MAX if there is none. */
+static unsigned long long snapshotOldest(void)
+{
+	unsigned long long oldest = ULLONG_MAX;
+	listIter li;
+	listNode *ln;
+
+	pthread_mutex_lock(&server.snapshots_mutex);
+	listRewind(server.snapshots, &li);
+	while ((ln = listNext(&li))) {
+		snapshot *s = listNodeValue(ln);
+		if (s->seq < oldest) oldest = s->seq;
+	}
+	pthread_mutex_unlock(&server.snapshots_mutex);
+	return oldest;
+}
+
+/* The versions entry value is the pointer to the newest version. */
+static dbVersion *entryVersions(index_entry *e)
+{
+	dbVersion *v;
+
+	memcpy(&v, ENTRY_VAL_SLOT(e), sizeof(v));
+	return v;
+}
+
+static void freeVersions(dbVersion *v)
+{
+	while (v) {
+		dbVersion *next = v->next;
+		sdsfree(v->val);
+		zfree(v);
+		v = next;
+	}
+}
+
+/* Called before key is written in the calling shard while snapshotsOpen(),
+ * old being its entry or NULL if it does not exist yet. */
+void snapshotRecordWrite(sds key, index_entry *old)
+{
+	unsigned long long seq = __atomic_load_n(&server.snapshot_seq, __ATOMIC_SEQ_CST);
+	index_entry *e = NULL;
+	dbVersion *v, *head = NULL;
+
+	if (serverTL->versions == NULL) {
+		serverTL->versions = index_create(&skiplistIndexType);
+		if (serverTL->versions == NULL) {
+			server_panic("Unrecoverable error creating versions index.");
+		}
+	} else if ((e = index_lookup(serverTL->versions, key)) != NULL) {
+		head = entryVersions(e);
+		if (head->seq == seq) return;
+	}
+
+	v = zmalloc(sizeof(*v));
+	v->next = head;
+	v->seq = seq;
+	v->val = old ? sdsnewlen(ENTRY_VAL(old), old->vlen) : NULL;
+	if (e) {
+		index_update(serverTL->versions, e, (const char *)&v, sizeof(v));
+	} else if (index_insert(serverTL->versions, key, (const char *)&v,
+				sizeof(v)) == NULL) {
+		server_panic("Out of memory saving a version.");
+	}
+}
+
+/* Drop the versions no open snapshot can see any more. */
+void snapshotCron(void)
+{
+	ordered_index *versions = serverTL->versions;
+	unsigned long long oldest;
+	index_iter it;
+	index_entry *e;
+	list *drop;
+	listNode *ln;
+
+	if (versions == NULL || index_count(versions) == 0) return;
+
+	oldest = snapshotOldest();
+	drop = listCreate();
+	for (e = index_first(versions, &it); e; e = index_next(&it)) {
+		dbVersion *v = entryVersions(e), *prev = NULL;
+
+		/* newest first: cut the chain at the first one too old */
+		while (v && v->seq >= oldest) {
+			prev = v;
+			v = v->next;
+		}
+		if (prev == NULL) {
+			listAddNodeTail(drop, ENTRY_KEY(e));
+		} else {
+			prev->next = NULL;
+		}
+		freeVersions(v);
+	}
+
+	/* the keys belong to the entries, a skiplist delete frees only its own */
+	while ((ln = listFirst(drop))) {
+		index_delete(versions, listNodeValue(ln));
+		listDelNode(drop, ln);
+	}
+	listRelease(drop);
+}
+
+/* Version of the entry a snapshot sees, NULL if it sees the live value. */
+static dbVersion *versionAt(index_entry *e, snapshot *s)
+{
+	dbVersion *v, *seen = NULL;
+
+	for (v = entryVersions(e); v && v->seq >= s->seq; v = v->next) {
+		seen = v;
+	}
+	return seen;
+}
+
+static index_entry *iterStep(index_iter *iter, int reverse)
+{
+	return reverse ? index_prev(iter) : index_next(iter);
+}
+
+/* Set the current pair to the next key visible to the snapshot, merging
+ * the live keys with the keys having versions. Return 0 at the end. */
+static int snapshotAdvance(snapshotIter *it)
+{
+	while (it->le || it->oe) {
+		index_entry *le = it->le, *oe = it->oe;
+		dbVersion *v;
+		int cmp;
+
+		if (le == NULL) {
+			cmp = 1;
+		} else if (oe == NULL) {
+			cmp = -1;
+		} else {
+			cmp = index_key_compare(ENTRY_KEY(le), ENTRY_KEY(oe));
+			if (it->reverse) cmp = -cmp;
+		}
+
+		/* a live key nobody wrote after the snapshot */
+		if (cmp < 0) {
+			it->le = iterStep(&it->live, it->reverse);
+			it->key = ENTRY_KEY(le);
+			it->val = ENTRY_VAL(le);
+			it->vlen = le->vlen;
+			it->entry = le;
+			return 1;
+		}
+
+		it->oe = iterStep(&it->old, it->reverse);
+		if (cmp == 0) it->le = iterStep(&it->live, it->reverse);
+		if ((v = versionAt(oe, it->snap)) != NULL) {
+			/* written after the snapshot, deleted before it if NULL */
+			if (v->val == NULL) continue;
+			it->key = ENTRY_KEY(oe);
+			it->val = v->val;
+			it->vlen = sdslen(v->val);
+			it->entry = NULL;
+			return 1;
+		}
+		/* the versions are all older than the snapshot, it sees the live key */
+		if (cmp == 0) {
+			it->key = ENTRY_KEY(le);
+			it->val = ENTRY_VAL(le);
+			it->vlen = le->vlen;
+			it->entry = le;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static index_entry *seekIndex(ordered_index *idx, index_iter *iter, sds key,
+		int reverse)
+{
+	return reverse ? index_seek_last(idx, iter, key) : index_seek(idx, iter, key);
+}
+
+/* Position it on the first key >= key seen by s, the last key <= key in
+ * reverse. s may be NULL for the live keys. Return 0 if there is none. */
+int snapshotSeek(snapshotIter *it, snapshot *s, sds key, int reverse)
+{
+	it->snap = s;
+	it->reverse = reverse;
+	it->le = seekIndex(serverTL->idx, &it->live, key, reverse);
+	it->oe = NULL;
+	if (s && serverTL->versions) {
+		it->oe = seekIndex(serverTL->versions, &it->old, key, reverse);
+	}
+	return snapshotAdvance(it);
+}
+
+int snapshotNext(snapshotIter *it)
+{
+	return snapshotAdvance(it);
+}
@@ -0,0 +1,61 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include "db.h"
+
+/* A snapshot is a point in time view of the keys of every shard. It is
+ * numbered with the write sequence it was taken at, and writes done while
+ * snapshots are open keep the value they replace in the versions of their
+ * shard, tagged with the sequence they observed. The value a key had for
+ * snapshot s is the one saved by its oldest write with seq >= s->seq, or
+ * the live one when there is no such write. */
+typedef struct snapshot {
+	unsigned long long seq;
+	time_t ctime;               /* when it was taken, see snapshotExpired() */
+} snapshot;
+
+/* A value a key had before a write, NULL if it did not exist. Versions of
+ * a key are chained newest first. */
+typedef struct dbVersion {
+	struct dbVersion *next;
+	unsigned long long seq;     /* write sequence of the replacing write */
+	sds val;
+} dbVersion;
+
+/* Iterates the keys of the calling shard as seen by a snapshot, or the
+ * live ones without snapshot. It is valid until the next write. */
+typedef struct snapshotIter {
+	snapshot *snap;
+	int reverse;
+	index_iter live, old;
+	index_entry *le, *oe;       /* next live entry, next versions entry */
+	sds key;                    /* current key, value and its length */
+	const char *val;
+	size_t vlen;
+	index_entry *entry;         /* the live entry of the pair, NULL if saved */
+} snapshotIter;
+
+/* Writes check it before anything else, see snapshot.c */
+static inline int snapshotsOpen(void)
+{
+	return __atomic_load_n(&server.snapshots_open, __ATOMIC_SEQ_CST) != 0;
+}
+
+/* Every write saves versions for as long as a snapshot is open, so the
+ * holder of one that outlived snapshot-max-age gives up and closes it. */
+static inline int snapshotExpired(snapshot *s)
+{
+	return server.snapshot_max_age &&
+		__atomic_load_n(&server.unixtime, __ATOMIC_RELAXED) - s->ctime >
+		server.snapshot_max_age;
+}
+
+void initSnapshots(void);
+snapshot *snapshotOpen(void);
+void snapshotClose(snapshot *s);
+void snapshotRecordWrite(sds key, index_entry *old);
+void snapshotCron(void);
+int snapshotSeek(snapshotIter *it, snapshot *s, sds key, int reverse);
+int snapshotNext(snapshotIter *it);
+
+#endif
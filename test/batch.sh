@@ -0,0 +1,52 @@
+#! /bin/bash
+
+# mput, mget and mdelete, against an empty server on port 6666 with
+# flexible key/value lengths
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test mput/mget/mdelete"
+check "mput" "OK" "`$cli mput k03 v03 k01 v01 k04 v04 k02 v02`"
+check "mget" "v01
+v03
+
+v04" "`$cli mget k01 k03 k00 k04`"
+check "mget single" "v02" "`$cli mget k02`"
+check "mput same key" "OK" "`$cli mput k05 old k01 new k05 v05`"
+check "mget after overwrite" "new
+v05" "`$cli mget k01 k05`"
+check "mput odd arguments" "ERR wrong number of arguments for 'mput' command" "`$cli mput k06 v06 k07`"
+check "mget after error" "" "`$cli mget k06`"
+check "mdelete" "2" "`$cli mdelete k02 k00 k04`"
+check "mdelete same key" "1" "`$cli mdelete k03 k03`"
+check "mget after mdelete" "new
+
+
+v05" "`$cli mget k01 k02 k03 k05`"
+check "scan after mdelete" "k01
+k05" "`$cli scan k00 k99`"
+
+# a batch large enough to spread over the levels of the engines
+pairs=`seq -f "%03g" 0 299 | awk '{print "m" $1 " v" $1}' | shuf`
+check "mput batch" "OK" "`$cli mput $pairs`"
+keys=`seq -f "m%03g" 0 299`
+check "mget batch" "`seq -f "v%03g" 0 299`" "`$cli mget $keys`"
+check "scan batch" "$keys" "`$cli scan m m~`"
+check "mdelete batch" "302" "`$cli mdelete $keys k01 k05`"
+check "scan empty" "" "`$cli scan a z`"
+
+echo "test mput/mget/mdelete passed"
+
+exit 0
@@ -0,0 +1,79 @@
+#! /bin/bash
+
+# values large enough to be replied by reference or moved into the store,
+# against an empty server on port 6666 with flexible key/value lengths
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test values replied by reference"
+# 1k and more is referenced in place until the reply is sent
+old=`head -c 2000 /dev/zero | tr '\0' o`
+new=`head -c 3000 /dev/zero | tr '\0' n`
+small=`head -c 1023 /dev/zero | tr '\0' s`
+check "put" "OK" "`$cli put r1 $old`"
+check "get" "$old" "`$cli get r1`"
+check "put small" "OK" "`$cli put r2 $small`"
+check "mget" "$small
+$old" "`$cli mget r2 r1`"
+check "scan withvalues" "r1
+$old
+r2
+$small" "`$cli scan r r~ WITHVALUES`"
+
+# writes pipelined behind the reads: the replies keep the values read
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+printf 'get r1\r\nput r1 %s\r\nget r1\r\nmget r1 r2\r\nmput r1 %s r2 x\r\ndelete r1\r\nget r1\r\n' \
+	$new $old >&$fd
+printf '$2000\r\n%s\r\n+OK\r\n$3000\r\n%s\r\n*2\r\n$3000\r\n%s\r\n$1023\r\n%s\r\n+OK\r\n+1\r\n$-1\r\n' \
+	$old $new $new $small > /tmp/bigval_expect
+head -c `stat -c %s /tmp/bigval_expect` <&$fd > /tmp/bigval_out
+cmp -s /tmp/bigval_expect /tmp/bigval_out
+check "pipelined writes" "0" "$?"
+rm -f /tmp/bigval_expect /tmp/bigval_out
+exec {fd}>&-
+check "get after pipeline" "x" "`$cli get r2`"
+check "mdelete" "1" "`$cli mdelete r1 r2`"
+
+# 4k and more is moved into the store rather than copied
+echo "begin to test values moved into the store"
+for len in 4095 4096 5000 100 8000; do
+	val=`head -c $len /dev/zero | tr '\0' m`
+	check "put $len" "OK" "`$cli put m1 $val`"
+	check "get $len" "$val" "`$cli get m1`"
+done
+big1=`head -c 4096 /dev/zero | tr '\0' a`
+big2=`head -c 6000 /dev/zero | tr '\0' b`
+check "mput" "OK" "`$cli mput m2 $big1 m3 $big2 m2 $big2`"
+check "mget" "$big2
+$big2" "`$cli mget m2 m3`"
+check "scan withvalues" "m1
+$val
+m2
+$big2
+m3
+$big2" "`$cli scan m m~ WITHVALUES`"
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+printf 'get m1\r\nput m1 %s\r\ndelete m2\r\nget m1\r\n' $big1 >&$fd
+printf '$8000\r\n%s\r\n+OK\r\n+1\r\n$4096\r\n%s\r\n' $val $big1 > /tmp/bigval_expect
+head -c `stat -c %s /tmp/bigval_expect` <&$fd > /tmp/bigval_out
+cmp -s /tmp/bigval_expect /tmp/bigval_out
+check "pipelined moved values" "0" "$?"
+rm -f /tmp/bigval_expect /tmp/bigval_out
+exec {fd}>&-
+check "mdelete moved values" "2" "`$cli mdelete m1 m2 m3`"
+
+echo "test values replied by reference or moved into the store passed"
+
+exit 0
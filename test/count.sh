@@ -0,0 +1,62 @@
+#! /bin/bash
+
+# count and rank, against an empty server on port 6666 with flexible
+# key/value lengths
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test count/rank"
+check "count empty store" "0" "`$cli count a z`"
+check "rank empty store" "" "`$cli rank a`"
+for key in k01 k02 k03 k04 k05; do
+	check "put $key" "OK" "`$cli put $key v${key#k}`"
+done
+check "count" "5" "`$cli count k00 k99`"
+check "count inner" "3" "`$cli count k02 k04`"
+check "count between keys" "2" "`$cli count k015 k035`"
+check "count single" "1" "`$cli count k03 k03`"
+check "count empty" "0" "`$cli count m n`"
+check "count reversed" "ERR CURSORERR 'k04' should less or equal to 'k02'" "`$cli count k04 k02`"
+check "rank first" "0" "`$cli rank k01`"
+check "rank" "3" "`$cli rank k04`"
+check "rank last" "4" "`$cli rank k05`"
+check "rank missing" "" "`$cli rank k00`"
+check "delete" "1" "`$cli delete k02`"
+check "count after delete" "4" "`$cli count k00 k99`"
+check "rank after delete" "2" "`$cli rank k04`"
+check "put" "OK" "`$cli put k00 v00`"
+check "rank after insert" "3" "`$cli rank k04`"
+for key in k00 k01 k03 k04 k05; do
+	check "delete $key" "1" "`$cli delete $key`"
+done
+
+# keys spread over the levels of the engines
+for ((i = 0; i < 300; i += 3)); do
+	key=`printf "c%03d" $i`
+	check "put $key" "OK" "`$cli put $key v`"
+done
+check "count many" "100" "`$cli count c c~`"
+check "count many inner" "33" "`$cli count c100 c199`"
+check "rank many" "34" "`$cli rank c102`"
+check "rank many last" "99" "`$cli rank c297`"
+for ((i = 0; i < 300; i += 3)); do
+	key=`printf "c%03d" $i`
+	check "delete $key" "1" "`$cli delete $key`"
+done
+check "count after all deleted" "0" "`$cli count a z`"
+
+echo "test count/rank passed"
+
+exit 0
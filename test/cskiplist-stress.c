@@ -0,0 +1,127 @@
+/* Concurrent stress of the cskiplist engine: writers insert, update and
+ * delete while readers look up and walk the list in both directions, each
+ * read inside index_read_begin()/index_read_end(). Values are their key,
+ * so a torn or freed node shows up as a mismatch. Build it with
+ * "make cskiplist-stress", it is best run under -fsanitize=address or
+ * -fsanitize=thread. */
+#include "../index.h"
+#include "../cskiplist.h"
+#include "../epoch.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define KEYS 2000
+#define WRITERS 2
+#define READERS 3
+#define WRITES 400000
+
+static ordered_index *idx;
+static int stop;
+
+static sds keyOf(int i)
+{
+	return sdscatprintf(sdsempty(), "k%05d", i);
+}
+
+static void checkEntry(index_entry *e)
+{
+	sds key = ENTRY_KEY(e);
+
+	assert(e->vlen == sdslen(key));
+	assert(!memcmp(ENTRY_VAL(e), key, e->vlen));
+}
+
+static void *reader(void *arg)
+{
+	unsigned long found = 0;
+	index_iter it;
+	index_entry *e;
+	sds prev;
+	int i;
+
+	(void)arg;
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		for (i = 0; i < KEYS; i += 7) {
+			sds key = keyOf(i);
+
+			index_read_begin(idx);
+			if ((e = index_lookup(idx, key)) != NULL) {
+				assert(!index_key_compare(ENTRY_KEY(e), key));
+				checkEntry(e);
+				found++;
+			}
+			index_read_end(idx);
+			sdsfree(key);
+		}
+
+		/* the keys of a walk are in order, in both directions */
+		index_read_begin(idx);
+		prev = NULL;
+		for (e = index_first(idx, &it); e; e = index_next(&it)) {
+			checkEntry(e);
+			if (prev) assert(index_key_compare(prev, ENTRY_KEY(e)) < 0);
+			prev = ENTRY_KEY(e);
+		}
+		prev = NULL;
+		for (e = index_last(idx, &it); e; e = index_prev(&it)) {
+			if (prev) assert(index_key_compare(prev, ENTRY_KEY(e)) > 0);
+			prev = ENTRY_KEY(e);
+		}
+		index_read_end(idx);
+	}
+	return (void *)found;
+}
+
+/* Each writer owns the keys of its residue, so the final count is known. */
+static void *writer(void *arg)
+{
+	long w = (long)arg;
+	unsigned int seed = w * 7 + 1;
+	int r;
+
+	for (r = 0; r < WRITES; r++) {
+		int i = rand_r(&seed) % KEYS;
+		sds key;
+
+		if (i % WRITERS != w) continue;
+		key = keyOf(i);
+		if (rand_r(&seed) % 3) {
+			assert(index_insert(idx, key, key, sdslen(key)) != NULL);
+		} else {
+			index_delete(idx, key);
+		}
+		sdsfree(key);
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	pthread_t readers[READERS], writers[WRITERS];
+	unsigned long walked = 0;
+	index_iter it;
+	index_entry *e;
+	long i;
+
+	idx = index_create(&cskiplistIndexType);
+	assert(idx != NULL);
+	for (i = 0; i < READERS; i++) pthread_create(&readers[i], NULL, reader, NULL);
+	for (i = 0; i < WRITERS; i++) pthread_create(&writers[i], NULL, writer, (void *)i);
+	for (i = 0; i < WRITERS; i++) pthread_join(writers[i], NULL);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < READERS; i++) {
+		void *found;
+
+		pthread_join(readers[i], &found);
+		printf("reader %ld found %lu keys\n", i, (unsigned long)found);
+	}
+
+	for (e = index_first(idx, &it); e; e = index_next(&it)) walked++;
+	assert(walked == index_count(idx));
+	printf("cskiplist stress passed, %lu keys\n", walked);
+	index_release(idx);
+	return 0;
+}
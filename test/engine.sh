@@ -0,0 +1,59 @@
+#! /bin/bash
+
+# put/get/delete and the key order through an index engine, against an
+# empty server on port 6666 with flexible key/value lengths
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test put/get/delete"
+check "get missing" "" "`$cli get e`"
+check "put" "OK" "`$cli put e v`"
+check "get" "v" "`$cli get e`"
+# values growing past the room of their entry and shrinking back
+long=`head -c 3000 /dev/zero | tr '\0' l`
+check "put longer" "OK" "`$cli put e $long`"
+check "get longer" "$long" "`$cli get e`"
+check "put shorter" "OK" "`$cli put e s`"
+check "get shorter" "s" "`$cli get e`"
+check "put empty key" "OK" "`$cli put '' empty`"
+check "get empty key" "empty" "`$cli get ''`"
+check "delete empty key" "1" "`$cli delete ''`"
+check "delete" "1" "`$cli delete e`"
+check "delete missing" "0" "`$cli delete e`"
+check "get deleted" "" "`$cli get e`"
+
+echo "begin to test the key order"
+# keys of different lengths sharing prefixes, inserted out of order
+for key in `seq 0 199 | awk '{print "e" $1}' | shuf`; do
+	check "put $key" "OK" "`$cli put $key v$key`"
+done
+seq 0 199 | awk '{print "e" $1}' | sort > /tmp/engine_expect
+check "show" "tadpole:keys=200,min=e0,max=e99" "`$cli show | cut -d , -f 1-3`"
+check "scan" "`cat /tmp/engine_expect`" "`$cli scan e e~`"
+for key in `sed -n '1~2p' /tmp/engine_expect`; do
+	check "delete $key" "1" "`$cli delete $key`"
+done
+check "scan after delete" "`sed -n '2~2p' /tmp/engine_expect`" "`$cli scan e e~`"
+check "get kept" "ve1" "`$cli get e1`"
+check "get deleted key" "" "`$cli get e10`"
+for key in `sed -n '2~2p' /tmp/engine_expect`; do
+	check "delete $key" "1" "`$cli delete $key`"
+done
+check "show empty" "tadpole:keys=0,min=NULL,max=NULL" "`$cli show | cut -d , -f 1-3`"
+
+rm -f /tmp/engine_expect
+echo "test put/get/delete on the engine passed"
+
+exit 0
@@ -0,0 +1,62 @@
+#! /bin/bash
+
+# many clients pipelining at once, so that the I/O threads read, parse and
+# write for them, against an empty server on port 6666 with "io-threads 4"
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test I/O threads"
+for ((i = 0; i < 16; i++)); do
+	exec {fd}<>/dev/tcp/127.0.0.1/6666
+	fds[$i]=$fd
+done
+val=`head -c 2000 /dev/zero | tr '\0' t`
+for round in 1 2 3 4 5; do
+	# every client writes its keys, then reads them and the keys of the
+	# previous client, in requests split over several reads
+	for ((i = 0; i < 16; i++)); do
+		for ((j = 0; j < 50; j++)); do
+			printf 'put t%02d%02d %s%d\r\n' $i $j $val $round
+		done >&${fds[$i]}
+	done
+	for ((i = 0; i < 16; i++)); do
+		check "puts of $i" "50" "`head -n 50 <&${fds[$i]} | grep -c '^+OK'`"
+	done
+	for ((i = 0; i < 16; i++)); do
+		printf '*2\r\n$3\r\nget\r\n$5\r\nt%02d07\r\nping\r\n' $i >&${fds[$i]}
+		printf 'mget t%02d07 t%02d49\r\n' $i $(((i + 15) % 16)) >&${fds[$i]}
+	done
+	for ((i = 0; i < 16; i++)); do
+		res=`head -n 8 <&${fds[$i]} | tr -d '\r'`
+		check "replies of $i" "\$2001
+$val$round
++PONG
+*2
+\$2001
+$val$round
+\$2001
+$val$round" "$res"
+	done
+done
+for ((i = 0; i < 16; i++)); do
+	fd=${fds[$i]}
+	exec {fd}>&-
+done
+check "count" "800" "`$cli count t t~`"
+check "mdelete" "800" "`$cli mdelete $(seq -f 't%04g' 0 1599 | grep -v 't..[5-9].')`"
+
+echo "test I/O threads passed"
+
+exit 0
@@ -0,0 +1,51 @@
+#! /bin/bash
+
+# the maxclients limit, against a server on port 6666 with "maxclients 8"
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+# ping <fd>: send ping on fd and print the reply
+function ping() {
+	printf 'ping\r\n' >&$1
+	head -n 1 <&$1 | tr -d '\r'
+}
+
+echo "begin to test maxclients"
+for ((i = 0; i < 8; i++)); do
+	exec {fd}<>/dev/tcp/127.0.0.1/6666
+	fds[$i]=$fd
+	check "client $i" "+PONG" "`ping $fd`"
+done
+
+# one more is refused with an error, the others are still served
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+check "refused" "-ERR max number of clients reached" "`timeout 5 cat <&$fd | tr -d '\r'`"
+exec {fd}>&-
+check "refused cli" "ERR max number of clients reached" "`$cli ping`"
+check "served" "+PONG" "`ping ${fds[7]}`"
+
+# a closed client leaves its place
+fd=${fds[0]}
+exec {fd}>&-
+sleep 0.2
+check "accepted again" "PONG" "`$cli ping`"
+for ((i = 1; i < 8; i++)); do
+	fd=${fds[$i]}
+	exec {fd}>&-
+done
+
+echo "test maxclients passed"
+
+exit 0
@@ -0,0 +1,51 @@
+#! /bin/bash
+
+# the query buffer limit, against an empty server on port 6666 with
+# flexible key/value lengths and "client-query-buffer-limit 1mb"
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test the query buffer limit"
+# a command just under the limit is served
+val=`head -c 1000000 /dev/zero | tr '\0' q`
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+printf '*3\r\n$3\r\nput\r\n$3\r\nq01\r\n$%d\r\n%s\r\n' ${#val} $val >&$fd
+check "put under the limit" "+OK" "`head -n 1 <&$fd | tr -d '\r'`"
+exec {fd}>&-
+check "get under the limit" "1000001" "`$cli get q01 | wc -c`"
+
+# pipelined commands adding up past the limit are served as they come
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+(for ((i = 0; i < 20; i++)); do
+	printf 'ping\r\n%.0s' `seq 10000`
+done >&$fd) &
+check "pipelined past the limit" "200000" "`head -n 200000 <&$fd | grep -c PONG`"
+wait
+exec {fd}>&-
+
+# a command that does not fit closes the client, the others go on
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+(printf '*3\r\n$3\r\nput\r\n$3\r\nq02\r\n$3000000\r\n%s%s' $val $val >&$fd) 2> /dev/null
+# the unread rest of the command may turn the close into a reset
+timeout 5 cat <&$fd > /dev/null 2>&1
+check "closed past the limit" "closed" "`[ $? -ne 124 ] && echo closed`"
+exec {fd}>&-
+check "ping after close" "PONG" "`$cli ping`"
+check "not stored" "" "`$cli get q02`"
+check "delete" "1" "`$cli delete q01`"
+
+echo "test the query buffer limit passed"
+
+exit 0
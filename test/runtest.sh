@@ -25,7 +25,7 @@ if [ $? -ne 0 ]; then
 fi
 
 # run test script
-res=`sh test.sh`
+res=`bash test.sh`
 if [ $? -ne 0 ]; then
 	echo "$res"
 	redis-cli -p 6666 shutdown
@@ -34,7 +34,16 @@ if [ $? -ne 0 ]; then
 fi
 echo "$res"
 
-res=`sh del.sh`
+res=`bash del.sh`
+if [ $? -ne 0 ]; then
+	echo "$res"
+	redis-cli -p 6666 shutdown
+	clear
+	exit 1
+fi
+echo "$res"
+
+res=`bash slab.sh`
 if [ $? -ne 0 ]; then
 	echo "$res"
 	redis-cli -p 6666 shutdown
@@ -48,6 +57,69 @@ echo "$res"
 redis-cli -p 6666 shutdown
 clear
 
+# the commands on flexible lengths: run <conf lines> <scripts...> starts a
+# server on ../tadpole.conf without fixed-length and index-engine, with the
+# given lines appended, and runs the scripts against it
+testconf=/tmp/tadpole-test.conf
+function run() {
+	grep -v "^fixed-length\\|^index-engine" ../tadpole.conf > $testconf
+	echo -e "$1" >> $testconf
+	shift
+	# wait for the previous server to exit
+	while redis-cli -p 6666 ping > /dev/null 2>&1; do
+		sleep 0.1
+	done
+	clear
+	../tadpole -c $testconf
+	tries=50
+	while [ $tries -gt 0 ] && ! redis-cli -p 6666 ping > /dev/null 2>&1; do
+		tries=$((tries - 1))
+		sleep 0.1
+	done
+	if [ $tries -le 0 ]; then
+		echo "startup process failed, exit"
+		rm -f $testconf
+		exit 1
+	fi
+	for script in $@; do
+		res=`bash $script`
+		if [ $? -ne 0 ]; then
+			echo "$res"
+			redis-cli -p 6666 shutdown
+			clear
+			rm -f $testconf
+			exit 1
+		fi
+		echo "$res"
+	done
+	redis-cli -p 6666 shutdown
+}
+
+for engine in skiplist btree art cskiplist; do
+	echo "index-engine $engine"
+	run "index-engine $engine" engine.sh scan.sh count.sh batch.sh bigval.sh yield.sh
+done
+echo "client-query-buffer-limit 1mb"
+run "client-query-buffer-limit 1mb" querybuf.sh
+echo "maxclients 8"
+run "maxclients 8" maxclients.sh
+echo "unixsocket"
+run "unixsocket /tmp/tadpole-test.sock\nunixsocketperm 700" unixsocket.sh
+echo "snapshot-max-age 1"
+run "snapshot-max-age 1" snapshot.sh
+echo "io-uring yes"
+run "io-uring yes\nclient-query-buffer-limit 1mb" \
+	engine.sh scan.sh count.sh batch.sh bigval.sh querybuf.sh
+echo "io-threads 4"
+run "io-threads 4" engine.sh scan.sh count.sh batch.sh bigval.sh yield.sh iothreads.sh
+for engine in skiplist btree art cskiplist; do
+	echo "index-engine $engine, 4 shards"
+	run "index-engine $engine\nshards 4\nshard-bounds g n t" \
+		shards.sh engine.sh scan.sh count.sh batch.sh bigval.sh yield.sh
+done
+clear
+rm -f $testconf
+
 echo "All test passed"
 
 
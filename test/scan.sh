@@ -0,0 +1,170 @@
+#! /bin/bash
+
+# scan and rscan over key ranges, with LIMIT and WITHVALUES, against an
+# empty server on port 6666 with flexible key/value lengths
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+for key in k01 k02 k03 k04 k05; do
+	check "put $key" "OK" "`$cli put $key v${key#k}`"
+done
+
+echo "begin to test scan"
+check "scan" "k02
+k03
+k04" "`$cli scan k02 k04`"
+check "scan between keys" "k02
+k03" "`$cli scan k015 k035`"
+check "scan single" "k03" "`$cli scan k03 k03`"
+check "scan before first" "k01" "`$cli scan a k01`"
+check "scan after last" "k05" "`$cli scan k05 z`"
+check "scan all" "k01
+k02
+k03
+k04
+k05" "`$cli scan a z`"
+check "scan empty" "" "`$cli scan m n`"
+check "scan reversed" "ERR CURSORERR 'k99' should less or equal to 'k00'" "`$cli scan k99 k00`"
+
+echo "begin to test rscan"
+check "rscan" "k04
+k03
+k02" "`$cli rscan k02 k04`"
+check "rscan between keys" "k03
+k02" "`$cli rscan k015 k035`"
+check "rscan single" "k03" "`$cli rscan k03 k03`"
+check "rscan all" "k05
+k04
+k03
+k02
+k01" "`$cli rscan a z`"
+check "rscan empty" "" "`$cli rscan m n`"
+check "rscan reversed" "ERR CURSORERR 'k99' should less or equal to 'k00'" "`$cli rscan k99 k00`"
+
+# the cursor of the next page first, empty on the last page, then the keys
+echo "begin to test LIMIT"
+check "scan limit" "k03
+k01
+k02" "`$cli scan k00 k99 LIMIT 2`"
+check "scan limit next" "k05
+k03
+k04" "`$cli scan k03 k99 LIMIT 2`"
+check "scan limit last" "
+k05" "`$cli scan k05 k99 LIMIT 2`"
+check "scan limit exact" "
+k04
+k05" "`$cli scan k04 k99 LIMIT 2`"
+check "scan limit empty" "" "`$cli scan m n limit 2`"
+check "rscan limit" "k03
+k05
+k04" "`$cli rscan k00 k99 LIMIT 2`"
+check "rscan limit next" "k01
+k03
+k02" "`$cli rscan k00 k03 LIMIT 2`"
+check "rscan limit last" "
+k01" "`$cli rscan k00 k01 LIMIT 2`"
+check "scan bad limit" "ERR LIMIT should be a positive integer" "`$cli scan k00 k99 LIMIT 0`"
+check "scan negative limit" "ERR LIMIT should be a positive integer" "`$cli scan k00 k99 LIMIT -1`"
+check "scan limit not a number" "ERR LIMIT should be a positive integer" "`$cli scan k00 k99 LIMIT x`"
+check "scan limit missing" "ERR syntax error" "`$cli scan k00 k99 LIMIT`"
+check "scan bad option" "ERR syntax error" "`$cli scan k00 k99 foo`"
+# a page ends once it holds 1mb, before the limit
+val=`head -c 100000 /dev/zero | tr '\0' b`
+for ((i = 1; i <= 15; i++)); do
+	key=`printf "b%02d" $i`
+	check "put $key" "OK" "`$cli put $key $val`"
+done
+page=`$cli scan b b~ LIMIT 1000000000 WITHVALUES`
+check "scan limit bytes cursor" "b12" "`echo "$page" | head -n 1`"
+check "scan limit bytes keys" "11" "`echo "$page" | tail -n +2 | grep -c '^b[0-9]'`"
+page=`$cli rscan b b~ LIMIT 1000000000 WITHVALUES`
+check "rscan limit bytes cursor" "b04" "`echo "$page" | head -n 1`"
+check "scan limit bytes last" "
+b12
+$val
+b13
+$val
+b14
+$val
+b15
+$val" "`$cli scan b12 b~ LIMIT 1000000000 WITHVALUES`"
+for ((i = 1; i <= 15; i++)); do
+	key=`printf "b%02d" $i`
+	check "delete $key" "1" "`$cli delete $key`"
+done
+# following the cursors page by page visits every key once
+keys=""
+cursor=a
+while [ -n "$cursor" ]; do
+	page=`$cli scan $cursor z LIMIT 1`
+	cursor=`echo "$page" | head -n 1`
+	keys="$keys`echo "$page" | tail -n +2` "
+done
+check "scan pages" "k01 k02 k03 k04 k05 " "$keys"
+
+# each key followed by its value
+echo "begin to test WITHVALUES"
+check "scan withvalues" "k02
+v02
+k03
+v03" "`$cli scan k02 k03 WITHVALUES`"
+check "rscan withvalues" "k03
+v03
+k02
+v02" "`$cli rscan k02 k03 withvalues`"
+check "scan withvalues empty" "" "`$cli scan m n WITHVALUES`"
+check "scan limit withvalues" "k03
+k01
+v01
+k02
+v02" "`$cli scan k00 k99 LIMIT 2 WITHVALUES`"
+check "scan withvalues limit" "
+k05
+v05" "`$cli scan k05 k99 WITHVALUES LIMIT 2`"
+
+# the exact replies: arrays of bulk strings, binary safe
+echo "begin to test the scan replies"
+# reply <what> <expected> <command>: the raw reply to a command
+function reply() {
+	exec {fd}<>/dev/tcp/127.0.0.1/6666
+	printf "$3" >&$fd
+	printf "$2" > /tmp/scan_expect
+	timeout 5 head -c `stat -c %s /tmp/scan_expect` <&$fd > /tmp/scan_out
+	exec {fd}>&-
+	cmp -s /tmp/scan_expect /tmp/scan_out
+	check "$1" "0" "$?"
+}
+reply "put binary" '+OK\r\n' '*3\r\n$3\r\nput\r\n$3\r\nk06\r\n$5\r\na\r\nb\n\r\n'
+reply "scan reply" '*3\r\n$3\r\nk02\r\n$3\r\nk03\r\n$3\r\nk04\r\n' \
+	'scan k02 k04\r\n'
+reply "scan empty reply" '*0\r\n' 'scan m n\r\n'
+reply "scan withvalues reply" '*4\r\n$3\r\nk05\r\n$3\r\nv05\r\n$3\r\nk06\r\n$5\r\na\r\nb\n\r\n' \
+	'scan k05 k06 WITHVALUES\r\n'
+reply "rscan withvalues reply" '*4\r\n$3\r\nk06\r\n$5\r\na\r\nb\n\r\n$3\r\nk05\r\n$3\r\nv05\r\n' \
+	'rscan k05 k06 WITHVALUES\r\n'
+reply "scan limit reply" '*2\r\n$3\r\nk03\r\n*2\r\n$3\r\nk01\r\n$3\r\nk02\r\n' \
+	'scan k00 k99 LIMIT 2\r\n'
+reply "scan limit last reply" '*2\r\n$-1\r\n*2\r\n$3\r\nk05\r\n$3\r\nv05\r\n' \
+	'scan k05 k05 LIMIT 2 WITHVALUES\r\n'
+reply "scan limit empty reply" '*2\r\n$-1\r\n*0\r\n' 'scan m n LIMIT 2\r\n'
+rm -f /tmp/scan_out /tmp/scan_expect
+check "delete binary" "1" "`$cli delete k06`"
+
+for key in k01 k02 k03 k04 k05; do
+	check "delete $key" "1" "`$cli delete $key`"
+done
+echo "test scan/rscan/LIMIT/WITHVALUES passed"
+
+exit 0
@@ -0,0 +1,113 @@
+#! /bin/bash
+
+# routing of keys over shards, against an empty server on port 6666 with
+# "shards 4" and "shard-bounds g n t"
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test shard routing"
+# the engine fields of every shard follow
+check "show shards" "tadpole:keys=0,min=NULL,max=NULL,shards=4" "`$cli show | cut -d , -f 1-4`"
+# one key on each side of every bound
+check "put first" "OK" "`$cli put a va`"
+check "put bound" "OK" "`$cli put g vg`"
+check "put last" "OK" "`$cli put z vz`"
+check "get first" "va" "`$cli get a`"
+check "get bound" "vg" "`$cli get g`"
+check "get last" "vz" "`$cli get z`"
+check "mput across shards" "OK" "`$cli mput f vf n vn m vm t vt s vs`"
+check "mget across shards" "vf
+vg
+
+vm
+vn
+vs
+vt" "`$cli mget f g h m n s t`"
+check "show keys" "tadpole:keys=8,min=a,max=z,shards=4" "`$cli show | cut -d , -f 1-4`"
+
+echo "begin to test scan/rscan over shards"
+check "scan" "a
+f
+g
+m
+n
+s
+t
+z" "`$cli scan a z`"
+check "scan inner" "f
+g
+m" "`$cli scan b m`"
+check "rscan" "z
+t
+s
+n" "`$cli rscan n z`"
+check "scan withvalues" "m
+vm
+n
+vn" "`$cli scan h n withvalues`"
+# pages ending and starting on both sides of a bound
+check "scan limit" "g
+a
+f" "`$cli scan a z LIMIT 2`"
+check "scan limit next" "n
+g
+m" "`$cli scan g z LIMIT 2`"
+check "scan limit skips shard" "t
+s" "`$cli scan o z LIMIT 1`"
+check "rscan limit" "g
+s
+n
+m" "`$cli rscan a s LIMIT 3`"
+check "count" "8" "`$cli count a z`"
+check "count inner" "4" "`$cli count f n`"
+check "rank" "0" "`$cli rank a`"
+check "rank later shard" "6" "`$cli rank t`"
+check "rank missing" "" "`$cli rank h`"
+check "mdelete across shards" "8" "`$cli mdelete a f g m n s t z h`"
+check "show empty" "tadpole:keys=0,min=NULL,max=NULL,shards=4" "`$cli show | cut -d , -f 1-4`"
+
+# keys in every shard: without rank the engines walk them to count
+echo "begin to test many keys over shards"
+for c in a h o u; do
+	pairs=`seq -f "%03g" 0 99 | awk -v c=$c '{print c $1 " " c $1}'`
+	check "mput batch" "OK" "`$cli mput $pairs`"
+done
+for c in a h o u; do
+	seq -f "$c%03g" 0 99
+done > /tmp/shards_expect
+check "scan many" "`cat /tmp/shards_expect`" "`$cli scan a z`"
+check "rscan many" "`sort -r /tmp/shards_expect`" "`$cli rscan a z`"
+check "scan many inner" "`sed -n '150,251p' /tmp/shards_expect`" "`$cli scan h049 o050`"
+check "count many" "400" "`$cli count a z`"
+check "count many inner" "102" "`$cli count h049 o050`"
+check "rank many" "250" "`$cli rank o050`"
+check "mget many" "h099
+
+o000" "`$cli mget h099 o100 o000`"
+keys=""
+cursor=a
+while [ -n "$cursor" ]; do
+	page=`$cli scan $cursor z LIMIT 70`
+	cursor=`echo "$page" | head -n 1`
+	keys="$keys`echo "$page" | tail -n +2`
+"
+done
+check "scan many pages" "`cat /tmp/shards_expect`" "`echo -n "$keys"`"
+check "mdelete many" "400" "`$cli mdelete $(cat /tmp/shards_expect)`"
+rm -f /tmp/shards_expect
+
+echo "test shards passed"
+
+exit 0
@@ -0,0 +1,59 @@
+#! /bin/bash
+
+# slab accounting reported by show in fixed-length mode (16/256), against a
+# server on port 6666 without keys starting with "slab"
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+# field <name>: value of a show field
+function field() {
+	$cli show | tr ',' '\n' | grep "^$1=" | cut -d = -f 2
+}
+
+echo "begin to test slab accounting"
+val=`head -c 256 /dev/zero | tr '\0' v`
+val2=`head -c 256 /dev/zero | tr '\0' w`
+used0=`field slab_used`
+check "slab_used reported" "1" "`[ -n "$used0" ] && echo 1`"
+
+check "put" "OK" "`$cli put slab000000000000 $val`"
+used1=`field slab_used`
+check "slab_used grows" "1" "`[ $used1 -gt $used0 ] && echo 1`"
+check "overwrite" "OK" "`$cli put slab000000000000 $val2`"
+check "overwrite in place" "$used1" "`field slab_used`"
+
+for ((i = 1; i < 100; i++)); do
+	key=`printf "slab%012d" $i`
+	check "put $key" "OK" "`$cli put $key $val`"
+done
+used100=`field slab_used`
+allocated=`field slab_allocated`
+check "slab_used grows with keys" "1" "`[ $used100 -gt $used1 ] && echo 1`"
+check "slab_allocated covers slab_used" "1" "`[ $allocated -ge $used100 ] && echo 1`"
+
+# freed slots go back to the arena, which keeps its memory
+for ((i = 1; i < 100; i++)); do
+	key=`printf "slab%012d" $i`
+	check "delete $key" "1" "`$cli delete $key`"
+done
+check "slab_used after delete" "$used1" "`field slab_used`"
+check "slab_allocated after delete" "$allocated" "`field slab_allocated`"
+check "get" "$val2" "`$cli get slab000000000000`"
+check "delete" "1" "`$cli delete slab000000000000`"
+check "slab_used back" "$used0" "`field slab_used`"
+
+echo "test slab accounting passed"
+
+exit 0
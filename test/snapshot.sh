@@ -0,0 +1,64 @@
+#! /bin/bash
+
+# a scan outliving its snapshot, against an empty server on port 6666 with
+# flexible key/value lengths and "snapshot-max-age 1"
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+dir=`grep ^dir ../tadpole.conf | awk -F ' ' '{print $2}'`
+logfile=`grep ^logfile ../tadpole.conf | awk -F ' ' '{print $2}' | tr -d '"'`
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test snapshot-max-age"
+# 20MB of values, more than the socket buffers take
+val=`head -c 4000 /dev/zero | tr '\0' s`
+for ((i = 0; i < 5000; i += 100)); do
+	args=""
+	for ((j = i; j < i + 100; j++)); do
+		args="$args `printf 's%04d' $j` $val"
+	done
+	check "mput $i" "OK" "`$cli mput $args`"
+done
+
+# a client not reading its scan holds the snapshot, writes go on beside it
+closed=`grep -c "scan outlived snapshot-max-age" $dir/$logfile`
+exec {fd}<>/dev/tcp/127.0.0.1/6666
+printf '*4\r\n$4\r\nscan\r\n$5\r\ns0000\r\n$5\r\ns4999\r\n$10\r\nWITHVALUES\r\n' >&$fd
+sleep 1
+check "put during the scan" "OK" "`$cli put s0000 new`"
+sleep 3
+# then the reply is cut short by closing the client
+timeout 5 cat <&$fd > /tmp/tadpole-test.reply
+check "closed past the age" "0" "$?"
+exec {fd}>&-
+size=`stat -c %s /tmp/tadpole-test.reply`
+rm -f /tmp/tadpole-test.reply
+check "reply cut short" "1" "$((size < 20000000))"
+check "logged" "$((closed + 1))" "`grep -c "scan outlived snapshot-max-age" $dir/$logfile`"
+
+# the server goes on, with no snapshot left open
+check "ping after close" "PONG" "`$cli ping`"
+check "get after close" "new" "`$cli get s0000`"
+check "count" "5000" "`$cli count s0000 s4999`"
+check "scan" "s0000 s0001 s0002" "`$cli scan s0000 s0002 | xargs`"
+for ((i = 0; i < 5000; i += 100)); do
+	args=""
+	for ((j = i; j < i + 100; j++)); do
+		args="$args `printf 's%04d' $j`"
+	done
+	check "mdelete $i" "100" "`$cli mdelete $args`"
+done
+
+echo "test snapshot-max-age passed"
+
+exit 0
@@ -0,0 +1,37 @@
+#! /bin/bash
+
+# clients on the Unix socket, against an empty server on port 6666 with
+# "unixsocket /tmp/tadpole-test.sock" and "unixsocketperm 700"
+
+. ~/.bashrc
+
+sock=/tmp/tadpole-test.sock
+cli="redis-cli -p 6666"
+scli="redis-cli -s $sock"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+echo "begin to test the unix socket"
+check "socket" "socket 700" "`stat -c '%F %a' $sock`"
+check "ping" "PONG" "`$scli ping`"
+check "put" "OK" "`$scli put u1 v1`"
+check "get over tcp" "v1" "`$cli get u1`"
+check "put over tcp" "OK" "`$cli put u2 v2`"
+check "scan" "u1
+u2" "`$scli scan u u~`"
+val=`head -c 5000 /dev/zero | tr '\0' u`
+check "put large" "OK" "`$scli put u3 $val`"
+check "get large" "$val" "`$scli get u3`"
+check "mdelete" "3" "`$scli mdelete u1 u2 u3`"
+
+echo "test the unix socket passed"
+
+exit 0
@@ -0,0 +1,106 @@
+#! /bin/bash
+
+# scans long enough to yield between slices, against an empty server on
+# port 6666 with flexible key/value lengths; with "shards 4" and
+# "shard-bounds g n t" the second one goes over every shard
+
+. ~/.bashrc
+
+cli="redis-cli -p 6666"
+
+# check <what> <expected> <got>
+function check() {
+	if [ "$2" != "$3" ]; then
+		echo "$1 failed"
+		echo "expect=$2"
+		echo "got=$3"
+		exit 1
+	fi
+}
+
+# more keys than a scan visits at once: it yields to the event loop
+# between slices while other clients are served
+echo "begin to test a scan that yields"
+for ((i = 0; i < 5000; i += 500)); do
+	pairs=`seq -f "%05g" $i $((i + 499)) | awk '{print "y" $1 " val" $1}'`
+	check "mput batch" "OK" "`$cli mput $pairs`"
+done
+seq -f "y%05g" 0 4999 > /tmp/scan_expect
+
+for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+	$cli scan y y~ > /tmp/scan_out$i &
+done
+check "get during scans" "val00042" "`$cli get y00042`"
+wait
+for i in 1 2 3 4 5 6 7 8 9 10 11 12; do
+	diff /tmp/scan_out$i /tmp/scan_expect > /dev/null
+	if [ $? -ne 0 ]; then
+		echo "concurrent scan $i failed"
+		rm -f /tmp/scan_out* /tmp/scan_expect
+		exit 1
+	fi
+done
+
+check "large count" "5000" "`$cli count y y~`"
+check "large rscan" "`sort -r /tmp/scan_expect`" "`$cli rscan y y~`"
+check "large scan withvalues" "`awk '{print; print "val" substr($1, 2)}' /tmp/scan_expect`" \
+	"`$cli scan y y~ WITHVALUES`"
+# scans pipelined on many connections at once, so that with io-threads
+# the threads are busy writing and then parse the next round. A command
+# pipelined behind a scan is answered after it: the array header, a $len
+# line and a key line per key, then the get.
+for ((i = 0; i < 12; i++)); do
+	exec {fd}<>/dev/tcp/127.0.0.1/6666
+	fds[$i]=$fd
+done
+for round in 1 2 3; do
+	for fd in ${fds[@]}; do
+		printf 'scan y y~\r\nget y04999\r\n' >&$fd
+	done
+	for fd in ${fds[@]}; do
+		res=`head -n 10003 <&$fd | tr -d '\r'`
+		check "pipelined scan" "*5000" "`echo "$res" | head -n 1`"
+		check "pipelined after scan" "val04999" "`echo "$res" | tail -n 1`"
+	done
+done
+for fd in ${fds[@]}; do
+	exec {fd}>&-
+done
+keys=`cat /tmp/scan_expect`
+check "large mdelete" "5000" "`$cli mdelete $keys`"
+
+rm -f /tmp/scan_out* /tmp/scan_expect
+
+# a scan over the key space long enough to yield, while other clients write
+echo "begin to test a scan over the key space that yields"
+for c in a h o u; do
+	pairs=`seq -f "%04g" 0 1499 | awk -v c=$c '{print c $1 " " c $1}'`
+	check "mput batch" "OK" "`$cli mput $pairs`"
+done
+for c in a h o u; do
+	seq -f "$c%04g" 0 1499
+done > /tmp/scan_expect
+
+for i in 1 2 3 4 5 6 7 8; do
+	$cli scan a z > /tmp/scan_out$i &
+done
+check "put during scans" "OK" "`$cli put zz vzz`"
+wait
+for i in 1 2 3 4 5 6 7 8; do
+	diff /tmp/scan_out$i /tmp/scan_expect > /dev/null
+	if [ $? -ne 0 ]; then
+		echo "concurrent scan $i failed"
+		rm -f /tmp/scan_out* /tmp/scan_expect
+		exit 1
+	fi
+done
+check "large count" "6000" "`$cli count a z`"
+check "large rscan" "`sort -r /tmp/scan_expect`" "`$cli rscan a z`"
+check "large rank" "4500" "`$cli rank u0000`"
+keys=`cat /tmp/scan_expect`
+check "large mdelete" "6001" "`$cli mdelete $keys zz`"
+
+rm -f /tmp/scan_out* /tmp/scan_expect
+echo "test scans that yield passed"
+
+exit 0
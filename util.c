@@ -14,8 +14,12 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 unsigned int dictHash(sds key) {
     return dictGenHashFunction(key, sdslen(key));
@@ -62,30 +66,72 @@ static void freeClientArgv(client *c)
 }
 
 
+static void unlinkClientReplyRefs(client *c);
+
 void freeClient(client *c)
 {
 	if (c == NULL) {
 		return;
 	}
 
+	/* A job still reads its argv, it is freed once the job is done. */
+	if (c->flags & CLIENT_SHARD_WAIT) {
+		c->flags |= CLIENT_CLOSE_ASAP;
+		aeDeleteFileEvent(serverTL->el, c->fd, AE_READABLE);
+		aeDeleteFileEvent(serverTL->el, c->fd, AE_WRITABLE);
+		return;
+	}
+
 	/*  Free the query buffer */
-	if (c->querybuf != NULL) {
-		sdsfree(c->querybuf);
-		c->querybuf = NULL;
+	freeQueryBuffer(c);
+	if (c->client_node) {
+		listDelNode(serverTL->clients, c->client_node);
+		__atomic_sub_fetch(&server.connected_clients, 1, __ATOMIC_RELAXED);
 	}
 	
 	/* Free data structures. */
 	freeClientArgv(c);
+	listRelease(c->reply);
+	unlinkClientReplyRefs(c);
+
+	/* Remove from the list of clients with pending writes. */
+	if (c->flags & CLIENT_PENDING_WRITE) {
+		listNode *ln = listSearchKey(serverTL->clients_pending_write, c);
+		assert(ln != NULL);
+		listDelNode(serverTL->clients_pending_write, ln);
+	}
+
+	/* Remove from the list of clients waiting for an I/O thread read. */
+	if (c->flags & CLIENT_PENDING_READ) {
+		listNode *ln = listSearchKey(server.clients_pending_read, c);
+		assert(ln != NULL);
+		listDelNode(server.clients_pending_read, ln);
+	}
 	
 	/* Unregister async I/O handlers and close the socket. */
 	if (c->fd != -1) {
-		aeDeleteFileEvent(server.el, c->fd, AE_READABLE);
-		aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE);
+		aeDeleteFileEvent(serverTL->el, c->fd, AE_READABLE);
+		aeDeleteFileEvent(serverTL->el, c->fd, AE_WRITABLE);
 		close(c->fd);
 		c->fd = -1;
 	}
 	
 	zfree(c->argv);
+	if (c->flags & CLIENT_PARSER_ASIDE) {
+		c->argv = c->parser.argv;
+		c->argc = c->parser.argc;
+		freeClientArgv(c);
+		zfree(c->argv);
+	}
+	while (c->cmdq_len--) {
+		parsedCommand *pc = &c->cmdq[c->cmdq_len];
+		int j;
+
+		for (j = 0; j < pc->argc; j++) sdsfree(pc->argv[j]);
+		zfree(pc->argv);
+	}
+	zfree(c->cmdq);
+	zfree(c->buf);
 	zfree(c);
 	c = NULL;
 	return;
@@ -151,34 +197,313 @@ int yesnotoi(char *s)
 	else return -1;
 }
 
+/*-----------------------------------------------------------------------------
+ * Reply buffers
+ *
+ * Replies are appended to the static client buffer, then to the reply list
+ * once it is full, and written out by handleClientsWithPendingWrites()
+ * before the event loop goes to sleep, with a single writev() per client.
+ * A writable handler is only installed for clients whose socket could not
+ * take everything.
+ *
+ * Large values are not copied into the reply list but referenced in place.
+ * A reference is valid until the keyspace changes, so every write of the
+ * keyspace calls materializeReplyRefs() first.
+ *----------------------------------------------------------------------------*/
+void freeClientReplyValue(void *o)
+{
+	zfree(o);
+}
+
+int clientHasPendingReplies(client *c)
+{
+	return c->bufpos || listLength(c->reply);
+}
+
+/* Queue c to be written before the next sleep. Return SERVER_ERR if no
+ * reply should be accumulated for it. */
+static int prepareClientToWrite(client *c)
+{
+	/* the shard running the command takes the replies of its proxy */
+	if (c->flags & CLIENT_SHARD_PROXY) return SERVER_OK;
+	if (c->fd <= 0) return SERVER_ERR;
+
+	if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_WRITE)) {
+		c->flags |= CLIENT_PENDING_WRITE;
+		listAddNodeHead(serverTL->clients_pending_write, c);
+	}
+	return SERVER_OK;
+}
+
+static int _addReplyToBuffer(client *c, const char *s, size_t len)
+{
+	size_t available = PROTO_REPLY_CHUNK_BYTES - c->bufpos;
+
+	/* If there already are entries in the reply list, we cannot
+	 * add anything more to the static buffer. */
+	if (listLength(c->reply) > 0) return SERVER_ERR;
+
+	/* Check that the buffer has enough space available for this string. */
+	if (len > available) return SERVER_ERR;
+
+	/* connections that never get a reply never pay for the buffer */
+	if (c->buf == NULL) c->buf = zmalloc(PROTO_REPLY_CHUNK_BYTES);
+
+	memcpy(c->buf + c->bufpos, s, len);
+	c->bufpos += len;
+	return SERVER_OK;
+}
+
+static void _addReplyStringToList(client *c, const char *s, size_t len)
+{
+	listNode *ln = listLast(c->reply);
+	clientReplyBlock *tail = ln ? listNodeValue(ln) : NULL;
+
+	/* Fill the last buffer block, then start a new one for the rest. */
+	if (tail && !tail->ref) {
+		size_t avail = tail->size - tail->used;
+		size_t copy = avail >= len ? len : avail;
+		memcpy(tail->buf + tail->used, s, copy);
+		tail->used += copy;
+		s += copy;
+		len -= copy;
+		c->reply_bytes += copy;
+	}
+
+	if (len) {
+		size_t size = len > PROTO_REPLY_LIST_CHUNK ? len : PROTO_REPLY_LIST_CHUNK;
+		tail = zmalloc(sizeof(clientReplyBlock) + size);
+		tail->size = size;
+		tail->used = len;
+		tail->ref = NULL;
+		memcpy(tail->buf, s, len);
+		listAddNodeTail(c->reply, tail);
+		c->reply_bytes += len;
+	}
+}
+
+/* Add reply to the output of c, reply is freed by this call. */
 void addReply(client *c, sds reply)
 {
-	ssize_t nwritten = 0, total = sdslen(reply);
-	ssize_t to_write;
-	char *pos = reply;
-
-	while (total > 0) {
-		to_write = total > 16 * 1024 ? 16 * 1024 : total;
-		nwritten = write(c->fd, pos, to_write);
-		if (nwritten == -1) {
-			if (errno == EAGAIN) {
-				continue;
+	addReplyString(c, reply, sdslen(reply));
+	sdsfree(reply);
+}
+
+void addReplyString(client *c, const char *s, size_t len)
+{
+	if (prepareClientToWrite(c) != SERVER_OK) return;
+	if (_addReplyToBuffer(c, s, len) != SERVER_OK) {
+		_addReplyStringToList(c, s, len);
+	}
+}
+
+/* Add a bulk reply copied from the len bytes at p. */
+void addReplyBulkCBuffer(client *c, const char *p, size_t len)
+{
+	char hdr[LONG_STR_SIZE + 3];
+	int hlen = snprintf(hdr, sizeof(hdr), "$%zu\r\n", len);
+
+	addReplyString(c, hdr, hlen);
+	addReplyString(c, p, len);
+	addReplyString(c, "\r\n", 2);
+}
+
+/* Add a bulk reply of len bytes at p, which belong to an index entry.
+ * Large values are referenced rather than copied, unless the reply goes
+ * to another shard. */
+void addReplyBulkRef(client *c, const char *p, size_t len)
+{
+	char hdr[LONG_STR_SIZE + 3];
+	int hlen = snprintf(hdr, sizeof(hdr), "$%zu\r\n", len);
+	clientReplyBlock *ref;
+
+	addReplyString(c, hdr, hlen);
+	if (len < PROTO_REPLY_REF_MIN || (c->flags & CLIENT_SHARD_PROXY)) {
+		addReplyString(c, p, len);
+	} else if (prepareClientToWrite(c) == SERVER_OK) {
+		/* the static buffer is always written before the list */
+		ref = zmalloc(sizeof(clientReplyBlock));
+		ref->size = 0;
+		ref->used = len;
+		ref->ref = p;
+		listAddNodeTail(c->reply, ref);
+		c->reply_bytes += len;
+		if (!(c->flags & CLIENT_REPLY_REFS)) {
+			c->flags |= CLIENT_REPLY_REFS;
+			listAddNodeTail(serverTL->clients_reply_refs, c);
+			c->refs_node = listLast(serverTL->clients_reply_refs);
+		}
+	}
+	addReplyString(c, "\r\n", 2);
+}
+
+static void unlinkClientReplyRefs(client *c)
+{
+	if (c->flags & CLIENT_REPLY_REFS) {
+		listDelNode(serverTL->clients_reply_refs, c->refs_node);
+		c->refs_node = NULL;
+		c->flags &= ~CLIENT_REPLY_REFS;
+	}
+}
+
+/* Copy every referenced value still waiting in a reply list, the keyspace
+ * is about to change. */
+void materializeReplyRefs(void)
+{
+	listIter li, ri;
+	listNode *ln, *rn;
+
+	listRewind(serverTL->clients_reply_refs, &li);
+	while ((ln = listNext(&li))) {
+		client *c = listNodeValue(ln);
+
+		listRewind(c->reply, &ri);
+		while ((rn = listNext(&ri))) {
+			clientReplyBlock *o = listNodeValue(rn), *copy;
+			if (!o->ref) continue;
+
+			copy = zmalloc(sizeof(clientReplyBlock) + o->used);
+			copy->size = copy->used = o->used;
+			copy->ref = NULL;
+			memcpy(copy->buf, o->ref, o->used);
+			rn->value = copy;
+			zfree(o);
+		}
+		unlinkClientReplyRefs(c);
+	}
+}
+
+/* Write as much of the output of c as the socket takes, gathering the
+ * static buffer and the reply list in one writev(). Only c is touched, so
+ * I/O threads call it too. Return SERVER_ERR on a write error. */
+int writeClientReplies(client *c)
+{
+	struct iovec iov[IOV_MAX];
+	ssize_t nwritten = 0, totwritten = 0;
+	size_t iovmax = sizeof(iov) / sizeof(iov[0]);
+	size_t offset, iovcnt, batch;
+	listIter li;
+	listNode *ln;
+
+	while (clientHasPendingReplies(c)) {
+		/* the first pending piece was already partly sent */
+		offset = c->sentlen;
+		iovcnt = 0;
+		batch = 0;
+		if (c->bufpos > 0) {
+			iov[iovcnt].iov_base = c->buf + offset;
+			iov[iovcnt].iov_len = c->bufpos - offset;
+			batch += iov[iovcnt++].iov_len;
+			offset = 0;
+		}
+		listRewind(c->reply, &li);
+		while ((ln = listNext(&li)) && iovcnt < iovmax && batch < NET_MAX_WRITES_PER_EVENT) {
+			clientReplyBlock *o = listNodeValue(ln);
+			iov[iovcnt].iov_base = (char *)(o->ref ? o->ref : o->buf) + offset;
+			iov[iovcnt].iov_len = o->used - offset;
+			batch += iov[iovcnt++].iov_len;
+			offset = 0;
+		}
+		nwritten = writev(c->fd, iov, iovcnt);
+		if (nwritten <= 0) break;
+		totwritten += nwritten;
+
+		/* drop what was sent: the static buffer, then the list head */
+		if (c->bufpos > 0) {
+			size_t left = c->bufpos - c->sentlen;
+			if ((size_t)nwritten < left) {
+				c->sentlen += nwritten;
+				nwritten = 0;
+			} else {
+				nwritten -= left;
+				c->bufpos = 0;
+				c->sentlen = 0;
 			}
 		}
-		total -= nwritten;
-		pos += nwritten;
+		while (nwritten > 0) {
+			clientReplyBlock *o = listNodeValue(listFirst(c->reply));
+			size_t left = o->used - c->sentlen;
+			if ((size_t)nwritten < left) {
+				c->sentlen += nwritten;
+				break;
+			}
+			nwritten -= left;
+			c->sentlen = 0;
+			c->reply_bytes -= o->used;
+			listDelNode(c->reply, listFirst(c->reply));
+		}
+
+		/* Give other clients a chance, the rest is sent once the socket
+		 * is writable again. */
+		if (totwritten > NET_MAX_WRITES_PER_EVENT) break;
 	}
-	sdsfree(reply);
-	return;
+
+	if (nwritten == -1 && errno != EAGAIN) {
+		server_log(LL_VERBOSE, "Error writing to client: %s", strerror(errno));
+		return SERVER_ERR;
+	}
+	if (!clientHasPendingReplies(c)) c->sentlen = 0;
+	return SERVER_OK;
 }
 
-void addReplyString(client *c, const char *s, size_t len)
+static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+
+/* Main thread part of a write: drop the reply references once the replies
+ * are out, otherwise make sure a write handler sends the rest. Return
+ * SERVER_ERR if the client was freed. */
+int finishClientWrite(client *c, int handler_installed)
 {
-	write(c->fd, s, len);
+	if (!clientHasPendingReplies(c)) {
+		unlinkClientReplyRefs(c);
+		if (handler_installed) aeDeleteFileEvent(serverTL->el, c->fd, AE_WRITABLE);
+	} else if (!handler_installed &&
+		aeCreateFileEvent(serverTL->el, c->fd, AE_WRITABLE,
+			sendReplyToClient, c) == AE_ERR)
+	{
+		freeClient(c);
+		return SERVER_ERR;
+	}
+	return SERVER_OK;
+}
 
-	return;
+/* Return SERVER_ERR if the client was freed. */
+static int writeToClient(client *c, int handler_installed)
+{
+	if (writeClientReplies(c) == SERVER_ERR) {
+		freeClient(c);
+		return SERVER_ERR;
+	}
+	return finishClientWrite(c, handler_installed);
 }
 
+/* Write event handler. Just send data to the client. */
+static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask)
+{
+	UNUSED(el);
+	UNUSED(fd);
+	UNUSED(mask);
+	writeToClient(privdata, 1);
+}
+
+/* Called before going to sleep: write the pending replies directly, and
+ * only install a write handler for the clients that could not take them
+ * all. */
+void handleClientsWithPendingWrites(void)
+{
+	listIter li;
+	listNode *ln;
+
+	listRewind(serverTL->clients_pending_write, &li);
+	while ((ln = listNext(&li))) {
+		client *c = listNodeValue(ln);
+		c->flags &= ~CLIENT_PENDING_WRITE;
+		listDelNode(serverTL->clients_pending_write, ln);
+
+		/* Try to write buffers to the client socket, what is left is
+		 * sent by a write handler. */
+		writeToClient(c, 0);
+	}
+}
 
 static void addReplyErrorLength(client *c, const char *s, size_t len)
 {
@@ -211,6 +536,65 @@ void addReplyErrorFormat(client *c, const char *fmt, ...)
 }
 
 
+/* Convert a string representing an amount of memory into the number of
+ * bytes, so for instance memtoll("1Gb") will return 1073741824 that is
+ * (1024*1024*1024).
+ *
+ * On parsing error, if *err is not NULL, it's set to 1, otherwise it's
+ * set to 0. On error the function return value is 0, regardless of the
+ * fact 'err' is NULL or not. */
+long long memtoll(const char *p, int *err) {
+	const char *u;
+	char buf[128];
+	long mul; /* unit multiplier */
+	long long val;
+	unsigned int digits;
+
+	if (err) *err = 0;
+
+	/* Search the first non digit character. */
+	u = p;
+	if (*u == '-') u++;
+	while(*u && isdigit(*u)) u++;
+	if (*u == '\0' || !strcasecmp(u,"b")) {
+		mul = 1;
+	} else if (!strcasecmp(u,"k")) {
+		mul = 1000;
+	} else if (!strcasecmp(u,"kb")) {
+		mul = 1024;
+	} else if (!strcasecmp(u,"m")) {
+		mul = 1000*1000;
+	} else if (!strcasecmp(u,"mb")) {
+		mul = 1024*1024;
+	} else if (!strcasecmp(u,"g")) {
+		mul = 1000L*1000*1000;
+	} else if (!strcasecmp(u,"gb")) {
+		mul = 1024L*1024*1024;
+	} else {
+		if (err) *err = 1;
+		return 0;
+	}
+
+	/* Copy the digits into a buffer, we'll use strtoll() to convert
+	 * the digit (without the unit) into a number. */
+	digits = u-p;
+	if (digits >= sizeof(buf)) {
+		if (err) *err = 1;
+		return 0;
+	}
+	memcpy(buf,p,digits);
+	buf[digits] = '\0';
+
+	char *endptr;
+	errno = 0;
+	val = strtoll(buf,&endptr,10);
+	if ((val == 0 && errno == EINVAL) || *endptr != '\0') {
+		if (err) *err = 1;
+		return 0;
+	}
+	return val*mul;
+}
+
 /* Convert a string into a long long. Returns 1 if the string could be parsed
  * into a (non-overflowing) long long, 0 otherwise. The value will be set to
  * the parsed value when appropriate. */
@@ -277,6 +661,28 @@ int string2ll(const char *s, size_t slen, long long *value) {
 	return 1;
 }
 
+/* Return the first occurrence of c in the len bytes at s, or NULL. Sixteen
+ * bytes are compared at once where SSE2 is available. */
+const char *findByte(const char *s, size_t len, char c)
+{
+	const char *end = s + len;
+
+#ifdef __SSE2__
+	__m128i needle = _mm_set1_epi8(c);
+
+	while (end - s >= 16) {
+		__m128i cmp = _mm_cmpeq_epi8(needle, _mm_loadu_si128((const __m128i *)s));
+		int bits = _mm_movemask_epi8(cmp);
+		if (bits) return s + __builtin_ctz(bits);
+		s += 16;
+	}
+#endif
+	for (; s < end; s++) {
+		if (*s == c) return s;
+	}
+	return NULL;
+}
+
 
 #define CONFIG_DEFAULT_PID_FILE "/var/run/redis.pid"
 void createPidFile(void)												  
@@ -317,10 +723,12 @@ uint64_t dictSdsHash(const void *key) {
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
-sds convertToResp(sds src)
+sds convertToResp(const char *src, size_t len)
 {
-	sds res = sdscatfmt(sdsempty(), "$%i\r\n%S\r\n", sdslen(src), src);
+	sds res = sdscatfmt(sdsempty(), "$%U\r\n", (unsigned long long)len);
 
+	res = sdscatlen(res, src, len);
+	res = sdscatlen(res, "\r\n", 2);
 	return res;
 }
 
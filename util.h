@@ -8,6 +8,7 @@ typedef long long mstime_t; /*  millisecond time type. */
 
 long long memtoll(const char *p, int *err);
 int string2ll(const char *s, size_t slen, long long *value);
+const char *findByte(const char *s, size_t len, char c);
 sds getAbsolutePath(char *filename);
 int pathIsBaseName(char *path);
 int yesnotoi(char *s);